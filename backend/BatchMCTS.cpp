@@ -1,4 +1,5 @@
 #include "BatchMCTS.h"
+#include "tablebase_evaluation.h"
 
 Sector &BatchMCTS::get_next_sector()
 {
@@ -27,10 +28,18 @@ void BatchMCTS::wait_until_no_workers()
 		queue_remove.wait(lock);
 }
 
+void BatchMCTS::set_tablebase_cache(int size_mb)
+{
+	wait_until_no_workers();
+	tablebase_cache = size_mb > 0 ? std::make_shared<TablebaseCache>(size_mb) : nullptr;
+	for (MCTS &m : arr)
+		m.set_tablebase_cache(tablebase_cache);
+}
+
 void BatchMCTS::play_best_moves(bool reset)
 {
 	wait_until_no_workers();
-	for (int i = 0; i < batch_size * num_sectors; i++)
+	for (int i = 0; i < (int)arr.size(); i++)
 	{
 		MCTS &m = arr[i];
 		m.undo_select();
@@ -38,7 +47,7 @@ void BatchMCTS::play_best_moves(bool reset)
 			m.play_best_move_and_reset();
 		else
 			m.play_best_move();
-		m.select(cpuct, boards[i], metadata[i]);
+		m.select(cpuct, boards, metadata, i * leaves_per_tree);
 	}
 }
 
@@ -61,11 +70,11 @@ void BatchMCTS::process_thread(Ndarray<float, 1> q, Ndarray<float, 4> policy, in
 		if (next < target)
 		{
 			int cur_idx = next;
-			int policy_index = next - (target - batch_size);
+			int policy_index = (next - (target - trees_per_sector)) * leaves_per_tree;
 			next++;
 			m.unlock();
-			arr[cur_idx].update(q[policy_index], policy[policy_index]);
-			arr[cur_idx].select(cpuct, boards[cur_idx], metadata[cur_idx]);
+			arr[cur_idx].update(q, policy, policy_index);
+			arr[cur_idx].select(cpuct, boards, metadata, cur_idx * leaves_per_tree);
 		}
 		else
 		{
@@ -79,9 +88,9 @@ void BatchMCTS::process_thread2(Ndarray<float, 1> q, Ndarray<float, 4> policy, i
 {
 	for (int cur = start; cur < end; cur++)
 	{
-		int policy_index = cur - (target - batch_size);
-		arr[cur].update(q[policy_index], policy[policy_index]);
-		arr[cur].select(cpuct, boards[cur], metadata[cur]);
+		int policy_index = (cur - (target - trees_per_sector)) * leaves_per_tree;
+		arr[cur].update(q, policy, policy_index);
+		arr[cur].select(cpuct, boards, metadata, cur * leaves_per_tree);
 	}
 }
 
@@ -108,31 +117,24 @@ void BatchMCTS::queue_consumer()
 
 void BatchMCTS::update_sector(int sector, Ndarray<float, 1> q, Ndarray<float, 4> policy)
 {
-	int next = sector * batch_size;
-	int target = next + batch_size;
+	// next and target are tree indices; each tree owns leaves_per_tree slots of the batch.
+	int next = sector * trees_per_sector;
+	int target = next + trees_per_sector;
 	// std::mutex m;
-	std::vector<std::thread> threads;
 	/*
-		for (int i = 0; i < num_threads; i++)
-		{
-			std::thread thd(&BatchMCTS::process_thread, this, q, policy, std::ref(next), target, std::ref(m));
-			threads.push_back(std::move(thd));
-		} */
+		pool.run([&](int i)
+				 { process_thread(q, policy, next, target, m); }); */
 
-	for (int i = 0; i < num_threads; i++)
+	if (steal_chunk_size > 0 && arenas.empty())
 	{
-		int start = (int)((1.0 * i / num_threads) * batch_size);
-		int end = (int)(1.0 * (i + 1) / num_threads * batch_size);
-		if (i == num_threads - 1)
-			end = batch_size;
-		std::thread thd(&BatchMCTS::process_thread2, this, q, policy, start + next, end + next, target);
-		threads.push_back(std::move(thd));
+		pool.parallel_for(next, target, steal_chunk_size, [&](int start, int end)
+						  { process_thread2(q, policy, start, end, target); });
+		return;
 	}
 
-	for (std::thread &t : threads)
-	{
-		t.join();
-	}
+	pool.run([&](int i)
+			 {
+		process_thread2(q, policy, static_split_begin(i) + next, static_split_begin(i + 1) + next, target); });
 	// std::cout << "updated sector " << cur_sector << "!\n";
 	// std::cout << "num working sectors: " << num_working_sectors() << "\n";
 }
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <time.h>
 #include "MCTS.h"
+#include "ThreadPool.h"
 
 struct Sector
 {
@@ -26,6 +27,8 @@ private:
 	int num_threads;
 	int batch_size;
 	int num_sectors;
+	int leaves_per_tree;	  // each tree owns leaves_per_tree consecutive slots of the batch
+	int trees_per_sector;	  // batch_size / leaves_per_tree
 	Ndarray<int, 3> boards;	  // (batch_size * num_sectors, 8, 8)
 	Ndarray<int, 2> metadata; // (batch_size * num_sectors, 5)
 
@@ -39,6 +42,14 @@ private:
 	std::condition_variable queue_add;	  // notify_all called when something is added to queue
 	std::condition_variable queue_remove; // notify_all called when something is removed from queue
 
+	std::shared_ptr<TranspositionTable> evaluation_cache; // shared by all trees; see set_evaluation_cache
+	std::shared_ptr<TablebaseCache> tablebase_cache;	  // shared by all trees; see set_tablebase_cache
+	std::vector<std::shared_ptr<ChunkArena>> arenas;	  // one per thread if thread_arenas is on
+	std::shared_ptr<GameWriter> game_writer;			  // writes the finished games of all trees; nullptr if there is no output
+	std::shared_ptr<ReplayBuffer> replay_buffer;		  // optional; every tree adds its finished games to it
+
+	ThreadPool pool;	  // num_threads workers that run update_sector
+	int steal_chunk_size; // trees per work stealing chunk in update_sector; 0 splits the sector statically
 	std::thread queue_consumer_thread;
 	bool alive = true; // will make false in destructor; signals queue_consumer to terminate
 
@@ -54,7 +65,18 @@ private:
 
 	int num_working_sectors();
 
+	// when a sector is split statically, worker i updates its trees static_split_begin(i), ..., static_split_begin(i + 1) - 1.
+	inline int static_split_begin(int i) { return (int)((long)i * trees_per_sector / num_threads); }
+
+	// the worker that updates the tree at index tree of its sector when sectors are split statically.
+	inline int static_split_owner(int tree) { return (int)(((long)tree + 1) * num_threads - 1) / trees_per_sector; }
+
 public:
+	static constexpr int suggested_steal_chunk_size = 8; // for set_work_stealing; stealing is off by default
+	static constexpr size_t arena_chunk_size = 1 << 14; // larger than the children buffer of any node
+	static constexpr size_t arena_chunks_per_slab = 256;
+	static constexpr int game_shards = 4; // the number of files that games are written to at a time
+
 	void wait_until_no_workers();
 	// calling this function ensures that the Ndarray corresponding to the current sector has finished being selected and updated
 	void select();
@@ -75,6 +97,113 @@ public:
 
 	void play_best_moves(bool reset);
 
+	// gives every tree its own transposition table, splitting size_mb megabytes between them. 0 disables them.
+	// replaces the evaluation cache. throws if that leaves less than a megabyte per tree; with that many trees,
+	// one shared table (set_evaluation_cache) makes better use of the memory.
+	inline void set_transposition_tables(int size_mb)
+	{
+		int size_mb_per_tree = size_mb / (int)arr.size();
+		if (size_mb > 0 && size_mb_per_tree == 0)
+			throw std::runtime_error("set_transposition_tables needs at least 1 MB per tree; use set_evaluation_cache instead");
+		wait_until_no_workers();
+		evaluation_cache = nullptr;
+		for (MCTS &m : arr)
+			m.set_transposition_table(size_mb > 0 ? std::make_shared<TranspositionTable>(size_mb_per_tree) : nullptr);
+	}
+
+	// makes all trees share one evaluation cache of size_mb megabytes, so a position evaluated for one game
+	// is never sent to the network again for another. 0 disables it. replaces the per tree transposition tables.
+	inline void set_evaluation_cache(int size_mb)
+	{
+		wait_until_no_workers();
+		evaluation_cache = size_mb > 0 ? std::make_shared<TranspositionTable>(size_mb, true) : nullptr;
+		for (MCTS &m : arr)
+			m.set_transposition_table(evaluation_cache);
+	}
+
+	// makes all trees share one cache of tablebase results of size_mb megabytes. 0 disables it.
+	void set_tablebase_cache(int size_mb);
+
+	// schedules each sector update in chunks of chunk_size trees that idle threads steal from busy ones.
+	// 0, the default, gives every thread one contiguous range of trees instead.
+	// with thread arenas, sectors are always split statically, so that a tree is only updated by the thread
+	// whose arena it allocates from.
+	inline void set_work_stealing(int chunk_size)
+	{
+		wait_until_no_workers();
+		steal_chunk_size = chunk_size;
+	}
+
+	// sets how every tree writes its games; see MCTS::set_record_format. the trees write TEXT_RECORDS by default.
+	inline void set_record_format(RecordFormat format)
+	{
+		wait_until_no_workers();
+		for (MCTS &m : arr)
+			m.set_record_format(format);
+	}
+
+	// blocks until every finished game has been written to disk, in files that are complete (see GameWriter).
+	inline void flush_games()
+	{
+		wait_until_no_workers();
+		if (game_writer)
+			game_writer->flush(true);
+	}
+
+	// makes every tree add its finished games to buffer. nullptr stops it.
+	inline void set_replay_buffer(std::shared_ptr<ReplayBuffer> buffer)
+	{
+		wait_until_no_workers();
+		replay_buffer = buffer;
+		for (MCTS &m : arr)
+			m.set_replay_buffer(buffer);
+	}
+
+	inline std::shared_ptr<ReplayBuffer> get_replay_buffer() { return replay_buffer; }
+
+	// the number of games finished so far; 0 if there is no output.
+	inline uint64_t num_finished_games() { return game_writer ? game_writer->games_pushed() : 0; }
+
+	// caps the memory of every tree at bytes_per_tree; see MCTS::set_memory_limit.
+	inline void set_memory_limit(uint64_t bytes_per_tree)
+	{
+		wait_until_no_workers();
+		for (MCTS &m : arr)
+			m.set_memory_limit(bytes_per_tree);
+	}
+
+	// sets the snapshot stride of every tree; see MCTS::set_snapshot_stride.
+	inline void set_snapshot_stride(int stride)
+	{
+		wait_until_no_workers();
+		for (MCTS &m : arr)
+			m.set_snapshot_stride(stride);
+	}
+
+	// the total number of bytes taken by all trees.
+	inline uint64_t memory_usage()
+	{
+		uint64_t tot = 0;
+		for (MCTS &m : arr)
+			tot += m.memory_usage();
+		return tot;
+	}
+
+	// bytes taken from the system by the thread arenas; 0 if they are off.
+	inline uint64_t arena_reserved_bytes()
+	{
+		uint64_t tot = 0;
+		for (auto &a : arenas)
+			tot += a->reserved_bytes();
+		return tot;
+	}
+
+	// returns the evaluation cache, or nullptr if there is none.
+	inline std::shared_ptr<TranspositionTable> get_evaluation_cache() { return evaluation_cache; }
+
+	// returns the tablebase cache, or nullptr if there is none.
+	inline std::shared_ptr<TablebaseCache> get_tablebase_cache() { return tablebase_cache; }
+
 	inline bool all_games_over()
 	{
 		wait_until_no_workers();
@@ -97,7 +226,7 @@ public:
 		return cnt / ((double)arr.size());
 	}
 
-	// writes the results of the games to the given array
+	// writes the results of the games to the given array (one entry per tree, i.e. batch_size * num_sectors / leaves_per_tree)
 	inline void results(Ndarray<int, 1> res)
 	{
 		wait_until_no_workers();
@@ -127,25 +256,32 @@ public:
 		int num_sims_per_move,
 		float temperature,
 		bool autoplay,
-		string output, // the base name of the output file.
+		string output, // the base name of the output files; see GameWriter.
 		int num_threads,
 		int batch_size,
 		int num_sectors,
 		float cpuct,
 		Ndarray<int, 3> boards,
-		Ndarray<int, 2> metadata) : num_threads(num_threads),
+		Ndarray<int, 2> metadata,
+		int leaves_per_tree = 1,
+		bool pin_threads = false,
+		bool thread_arenas = false) : cpuct(cpuct),
+									num_threads(num_threads),
 									batch_size(batch_size),
 									num_sectors(num_sectors),
-									cpuct(cpuct),
+									leaves_per_tree(leaves_per_tree),
+									trees_per_sector(batch_size / leaves_per_tree),
 									boards(boards),
 									metadata(metadata),
+									cur_sector(0),
 									working_sectors(
 										num_sectors,
 										Sector(
 											-1,
 											Ndarray<float, 1>(nullptr, nullptr, nullptr),
 											Ndarray<float, 4>(nullptr, nullptr, nullptr))),
-									cur_sector(0)
+									pool(num_threads, pin_threads),
+									steal_chunk_size(0)
 	{
 		if (boards.getShape(0) != batch_size * num_sectors || boards.getShape(1) != ROWS || boards.getShape(2) != COLS)
 		{
@@ -155,17 +291,30 @@ public:
 		{
 			throw std::runtime_error("metadata must have shape (batch_size * num_sectors, 5)");
 		}
-		this->arr.reserve(batch_size * num_sectors);
-		for (int i = 0; i < batch_size * num_sectors; i++)
+		else if (leaves_per_tree < 1 || batch_size % leaves_per_tree != 0)
+		{
+			throw std::runtime_error("batch_size must be a multiple of leaves_per_tree");
+		}
+		// with thread arenas, each tree allocates from a MemoryBlock whose chunks come from the arena of the thread
+		// that updates it (see update_sector).
+		for (int i = 0; thread_arenas && i < num_threads; i++)
+			arenas.push_back(std::make_shared<ChunkArena>(arena_chunk_size, arena_chunks_per_slab));
+		// the trees hand their finished games to one writer instead of each keeping a file open.
+		if (!output.empty())
+			game_writer = std::make_shared<GameWriter>(output, game_shards);
+		this->arr.reserve(trees_per_sector * num_sectors);
+		for (int i = 0; i < trees_per_sector * num_sectors; i++)
 		{
-			string new_output = "";
-			if (!output.empty())
+			if (thread_arenas)
 			{
-				long current_time = (long)std::chrono::system_clock::now().time_since_epoch().count();
-				new_output = output + "_" + std::to_string(i) + "_" + std::to_string(current_time);
+				std::shared_ptr<ChunkArena> &arena = arenas[static_split_owner(i % trees_per_sector)];
+				this->arr.emplace_back(num_sims_per_move, std::make_shared<MemoryBlock>(0, sizeof(MCTSNode), UINT64_MAX, arena),
+									   temperature, autoplay, "", leaves_per_tree);
 			}
-			this->arr.emplace_back(num_sims_per_move, temperature, autoplay, new_output);
-			this->arr.back().select(cpuct, boards[i], metadata[i]);
+			else
+				this->arr.emplace_back(num_sims_per_move, temperature, autoplay, "", leaves_per_tree);
+			this->arr.back().set_game_writer(game_writer);
+			this->arr.back().select(cpuct, boards, metadata, i * leaves_per_tree);
 		}
 		queue_consumer_thread = std::thread(&BatchMCTS::queue_consumer, this);
 	}
@@ -0,0 +1,201 @@
+#include "DataLoader.h"
+#include "GameRecord.h"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+// the lines of the text format, one game after the other:
+// board_state (ROWS * COLS + METADATA_LENGTH ints), policy (r,c,i,prob, for every legal move), move, color
+// for every move, then "<result> WINNER!"
+void DataLoader::parse_text(const std::string &data, Parsed &out)
+{
+	std::vector<const char *> lines;
+	for (size_t i = 0; i < data.size(); i = data.find('\n', i) + 1)
+	{
+		lines.push_back(data.c_str() + i);
+		if (data.find('\n', i) == std::string::npos)
+			break;
+	}
+
+	size_t game_begin = out.examples.size();
+	size_t i = 0;
+	while (i < lines.size())
+	{
+		const char *line = lines[i];
+		const char *eol = strchr(line, '\n');
+		size_t len = eol ? eol - line : strlen(line);
+		if (len >= 7 && strncmp(line + len - 7, "WINNER!", 7) == 0)
+		{
+			int result = (int)strtol(line, nullptr, 10);
+			for (size_t e = game_begin; e < out.examples.size(); e++)
+				out.examples[e].value = (int8_t)(out.examples[e].value * result);
+			game_begin = out.examples.size();
+			i++;
+			continue;
+		}
+		if (i + 3 >= lines.size())
+		{
+			out.ok = false;
+			return;
+		}
+
+		Example ex;
+		char *p = (char *)lines[i];
+		for (int j = 0; j < ROWS * COLS; j++)
+		{
+			ex.board[j] = (int8_t)strtol(p, &p, 10);
+			p++; // the comma
+		}
+		for (int j = 0; j < METADATA_LENGTH; j++)
+		{
+			ex.metadata[j] = (int8_t)strtol(p, &p, 10);
+			p++;
+		}
+
+		ex.policy_begin = out.entries.size();
+		p = (char *)lines[i + 1];
+		while (*p != '\n' && *p != '\0')
+		{
+			int r = (int)strtol(p, &p, 10);
+			int c = (int)strtol(p + 1, &p, 10);
+			int k = (int)strtol(p + 1, &p, 10);
+			float prob = strtof(p + 1, &p);
+			p++;
+			out.entries.emplace_back(r * COLS * MOVES_PER_SQUARE + c * MOVES_PER_SQUARE + k, prob);
+		}
+		ex.num_legal = (uint16_t)(out.entries.size() - ex.policy_begin);
+		// the sign of the result is applied once the game's result line is read.
+		ex.value = strncmp(lines[i + 3], "WHITE", 5) == 0 ? 1 : -1;
+		out.examples.push_back(ex);
+		i += 4;
+	}
+	// a game without a result is not finished.
+	out.examples.resize(game_begin);
+}
+
+void DataLoader::parse_binary(const std::string &data, Parsed &out)
+{
+	std::istringstream is(data);
+	std::vector<game_record::MoveRecord> moves;
+	int result;
+	while (is.peek() != EOF)
+	{
+		if (!game_record::read_game(is, moves, result))
+		{
+			out.ok = false;
+			return;
+		}
+		for (const game_record::MoveRecord &rec : moves)
+		{
+			Example ex;
+			for (int j = 0; j < ROWS * COLS; j++)
+				ex.board[j] = (int8_t)rec.board[j / COLS][j % COLS];
+			for (int j = 0; j < METADATA_LENGTH; j++)
+				ex.metadata[j] = (int8_t)rec.metadata[j];
+			ex.value = (int8_t)(rec.color == WHITE ? result : -result);
+			ex.policy_begin = out.entries.size();
+			ex.num_legal = (uint16_t)rec.policy.size();
+			// 16 bit probabilities do not add up to exactly 1.
+			float tot = 0;
+			for (const auto &entry : rec.policy)
+				tot += entry.second;
+			for (const auto &entry : rec.policy)
+				out.entries.emplace_back(entry.first, tot > 0 ? entry.second / tot : 0.0f);
+			out.examples.push_back(ex);
+		}
+	}
+}
+
+void DataLoader::parse_file(const std::string &path, Parsed &out)
+{
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (!in)
+	{
+		out.ok = false;
+		return;
+	}
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (data.compare(0, 4, game_record::MAGIC, 4) == 0)
+		parse_binary(data, out);
+	else
+		parse_text(data, out);
+}
+
+size_t DataLoader::load()
+{
+	std::vector<Parsed> parsed(pending_files.size());
+	pool.parallel_for(0, (int)pending_files.size(), 1, [&](int begin, int end)
+					  {
+		for (int f = begin; f < end; f++)
+			parse_file(pending_files[f], parsed[f]); });
+
+	for (Parsed &p : parsed)
+	{
+		if (!p.ok)
+		{
+			num_bad_files++;
+			continue;
+		}
+		uint64_t offset = entries.size();
+		for (Example &ex : p.examples)
+		{
+			ex.policy_begin += offset;
+			examples.push_back(ex);
+		}
+		entries.insert(entries.end(), p.entries.begin(), p.entries.end());
+	}
+	pending_files.clear();
+	new_epoch();
+	return examples.size();
+}
+
+void DataLoader::new_epoch()
+{
+	order.resize(examples.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = (uint32_t)i;
+	if (shuffle)
+		std::shuffle(order.begin(), order.end(), rng);
+	next = 0;
+}
+
+void DataLoader::fill_example(const Example &ex, const std::pair<uint16_t, float> *entries, int b,
+							  int *boards, int *metadata, float *policy, int *legal_moves, float *values)
+{
+	const size_t policy_size = ROWS * COLS * MOVES_PER_SQUARE;
+	for (int j = 0; j < ROWS * COLS; j++)
+		boards[b * ROWS * COLS + j] = ex.board[j];
+	for (int j = 0; j < METADATA_LENGTH; j++)
+		metadata[b * METADATA_LENGTH + j] = ex.metadata[j];
+	float *pol = policy + b * policy_size;
+	int *legal = legal_moves + b * policy_size;
+	memset(pol, 0, policy_size * sizeof(float));
+	memset(legal, 0, policy_size * sizeof(int));
+	for (uint64_t e = ex.policy_begin; e < ex.policy_begin + ex.num_legal; e++)
+	{
+		pol[entries[e].first] = entries[e].second;
+		legal[entries[e].first] = 1;
+	}
+	values[b] = ex.value;
+}
+
+int DataLoader::next_batch(int batch_size, int *boards, int *metadata, float *policy, int *legal_moves, float *values)
+{
+	int n = (int)std::min<size_t>(batch_size, order.size() - next);
+	pool.parallel_for(0, n, fill_chunk_size, [&](int begin, int end)
+					  {
+		for (int b = begin; b < end; b++)
+			fill_example(examples[order[next + b]], entries.data(), b, boards, metadata, policy, legal_moves, values); });
+	next += n;
+	return n;
+}
+
+void DataLoader::clear()
+{
+	examples.clear();
+	entries.clear();
+	order.clear();
+	next = 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <random>
+#include <stdint.h>
+#include "Constants.h"
+#include "ThreadPool.h"
+
+/*
+Loads self-play games (the text format and the binary formats of GameRecord.h, several games per file or one)
+and hands them out as training batches.
+Examples are kept in a compact form: boards and metadata as bytes and the policy as sparse (index, probability) pairs
+over the legal moves. Files are parsed and batches are filled on a pool of threads.
+All examples are held in memory so that an epoch can be shuffled over all of them: 80 bytes per position,
+8 per legal move and 4 for the epoch order, i.e. about 350 bytes for a position with 35 legal moves,
+or 3.5 GB for ten million positions. A set that does not fit is written to shards (see TrainingShard.h) a part
+at a time, and the shards are mapped instead of loaded.
+*/
+class DataLoader
+{
+public:
+	struct Example
+	{
+		int8_t board[ROWS * COLS];
+		int8_t metadata[METADATA_LENGTH];
+		int8_t value;			// the result of the game from the point of view of the side to move
+		uint16_t num_legal;		// the number of legal moves, i.e. of policy entries
+		uint64_t policy_begin;	// the index of the first policy entry in entries
+	};
+
+	// writes ex, whose policy entries start at entries[ex.policy_begin], to row b of the buffers of next_batch.
+	static void fill_example(const Example &ex, const std::pair<uint16_t, float> *entries, int b,
+							 int *boards, int *metadata, float *policy, int *legal_moves, float *values);
+
+private:
+	// what one file parses to; entries are indexed from 0.
+	struct Parsed
+	{
+		std::vector<Example> examples;
+		std::vector<std::pair<uint16_t, float>> entries;
+		bool ok = true;
+	};
+
+	ThreadPool pool;
+	bool shuffle;
+	std::mt19937_64 rng;
+	std::vector<std::string> pending_files; // added but not loaded yet
+	std::vector<Example> examples;
+	std::vector<std::pair<uint16_t, float>> entries;
+	std::vector<uint32_t> order; // the order of the current epoch
+	size_t next = 0;			 // the position in order of the next example to hand out
+	int num_bad_files = 0;
+
+	static void parse_text(const std::string &data, Parsed &out);
+	static void parse_binary(const std::string &data, Parsed &out);
+	static void parse_file(const std::string &path, Parsed &out);
+
+public:
+	static const int fill_chunk_size = 64; // examples per work stealing chunk when filling a batch
+
+	DataLoader(int num_threads, bool shuffle = true, uint64_t seed = std::random_device()()) : pool(num_threads), shuffle(shuffle), rng(seed) {}
+
+	DataLoader(const DataLoader &other) = delete;
+	DataLoader &operator=(const DataLoader &other) = delete;
+
+	// queues a game file to be read by the next load().
+	inline void add_file(const std::string &path) { pending_files.push_back(path); }
+
+	// parses the queued files in parallel and adds their examples, then starts a new epoch.
+	// files that cannot be parsed are skipped and counted by bad_files(). returns the number of examples.
+	size_t load();
+
+	// starts a new epoch over all examples, shuffled if shuffle is on.
+	void new_epoch();
+
+	/*
+	fills up to batch_size examples of the current epoch into C contiguous buffers:
+	boards (batch_size, ROWS, COLS), metadata (batch_size, METADATA_LENGTH), policy and legal_moves
+	(batch_size, ROWS, COLS, MOVES_PER_SQUARE), and values (batch_size).
+	returns the number of examples filled, which is less than batch_size at the end of the epoch and 0 after it.
+	*/
+	int next_batch(int batch_size, int *boards, int *metadata, float *policy, int *legal_moves, float *values);
+
+	// drops all examples.
+	void clear();
+
+	inline size_t size() { return examples.size(); }
+
+	// the loaded examples in the order they were read, and the policy entries they point into
+	inline const Example &example(size_t i) { return examples[i]; }
+	inline const std::pair<uint16_t, float> *policy_entries() { return entries.data(); }
+
+	inline int bad_files() { return num_bad_files; }
+};
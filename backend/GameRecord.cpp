@@ -0,0 +1,280 @@
+#include "GameRecord.h"
+#include "MCTS.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace game_record
+{
+	static inline void put8(std::ostream &os, uint8_t x) { os.put((char)x); }
+
+	static inline void put16(std::ostream &os, uint16_t x)
+	{
+		put8(os, x & 0xff);
+		put8(os, x >> 8);
+	}
+
+	static inline bool get8(std::istream &is, uint8_t &x)
+	{
+		int c = is.get();
+		x = (uint8_t)c;
+		return c != EOF;
+	}
+
+	static inline bool get16(std::istream &is, uint16_t &x)
+	{
+		uint8_t lo, hi;
+		if (!get8(is, lo) || !get8(is, hi))
+			return false;
+		x = lo | (hi << 8);
+		return true;
+	}
+
+	static inline uint16_t quantize(float prob)
+	{
+		return (uint16_t)std::lround(std::min(std::max(prob, 0.0f), 1.0f) * 65535.0f);
+	}
+
+	// writes the entries of policy, leaving out those that round to 0 if sparse is true.
+	static inline void write_policy(std::ostream &os, const std::vector<std::pair<uint16_t, float>> &policy, bool sparse)
+	{
+		int n = 0;
+		for (const auto &entry : policy)
+			n += !sparse || quantize(entry.second) > 0;
+		put8(os, (uint8_t)n);
+		for (const auto &entry : policy)
+		{
+			uint16_t prob = quantize(entry.second);
+			if (sparse && prob == 0)
+				continue;
+			put16(os, entry.first);
+			put16(os, prob);
+		}
+	}
+
+	static inline bool read_policy(std::istream &is, std::vector<std::pair<uint16_t, float>> &policy)
+	{
+		uint8_t n;
+		if (!get8(is, n))
+			return false;
+		policy.resize(n);
+		for (int i = 0; i < n; i++)
+		{
+			uint16_t index, prob;
+			if (!get16(is, index) || !get16(is, prob))
+				return false;
+			policy[i] = {index, prob / 65535.0f};
+		}
+		return true;
+	}
+
+	// plays m on p if it is legal. if legal_indices is given, the policy indices of all legal moves of p are written to it.
+	template <Color color>
+	static bool play_legal(Position &p, Move m, std::vector<uint16_t> *legal_indices)
+	{
+		MoveList<color> legals(p);
+		bool found = false;
+		PolicyIndex index;
+		if (legal_indices != nullptr)
+			legal_indices->clear();
+		for (Move l : legals)
+		{
+			found |= l.get_representation() == m.get_representation();
+			if (legal_indices != nullptr)
+			{
+				move2index(p, l, color, index);
+				legal_indices->push_back(index.r * COLS * MOVES_PER_SQUARE + index.c * MOVES_PER_SQUARE + index.i);
+			}
+		}
+		if (found)
+			p.play<color>(m);
+		return found;
+	}
+
+	static inline bool play_legal(Position &p, Move m, std::vector<uint16_t> *legal_indices = nullptr)
+	{
+		return p.turn() == WHITE ? play_legal<WHITE>(p, m, legal_indices) : play_legal<BLACK>(p, m, legal_indices);
+	}
+
+	static inline void write_position(Position &p, int board[ROWS][COLS], int metadata[METADATA_LENGTH])
+	{
+		if (p.turn() == WHITE)
+			writePosition<WHITE>(p, board, metadata);
+		else
+			writePosition<BLACK>(p, board, metadata);
+	}
+
+	void write_header(std::ostream &os)
+	{
+		os.write(MAGIC, 4);
+		put16(os, VERSION);
+		put8(os, ROWS);
+		put8(os, COLS);
+		put8(os, MOVES_PER_SQUARE);
+		put8(os, METADATA_LENGTH);
+	}
+
+	void write_start_position(std::ostream &os, const std::string &fen)
+	{
+		put8(os, START_TAG);
+		put8(os, (uint8_t)fen.size());
+		os.write(fen.data(), fen.size());
+	}
+
+	void write_move(std::ostream &os,
+					const int board[ROWS][COLS],
+					const int metadata[METADATA_LENGTH],
+					const std::vector<std::pair<uint16_t, float>> &policy,
+					Move m,
+					Color color)
+	{
+		char buf[BOARD_BYTES + 6];
+		buf[0] = MOVE_TAG;
+		for (int i = 0; i < BOARD_BYTES; i++)
+		{
+			int s = 2 * i;
+			buf[1 + i] = (char)((board[s / COLS][s % COLS] & 0xf) | ((board[(s + 1) / COLS][(s + 1) % COLS] & 0xf) << 4));
+		}
+		uint8_t castling = 0;
+		for (int i = 0; i < 4; i++)
+			castling |= (metadata[i] != 0) << i;
+		buf[BOARD_BYTES + 1] = (char)castling;
+		buf[BOARD_BYTES + 2] = (char)metadata[4];
+		uint16_t move = m.get_representation();
+		buf[BOARD_BYTES + 3] = (char)(move & 0xff);
+		buf[BOARD_BYTES + 4] = (char)(move >> 8);
+		buf[BOARD_BYTES + 5] = (char)color;
+		os.write(buf, sizeof(buf));
+		write_policy(os, policy, false);
+	}
+
+	void write_compact_move(std::ostream &os,
+							const std::vector<std::pair<uint16_t, float>> &policy,
+							Move m)
+	{
+		put8(os, COMPACT_MOVE_TAG);
+		put16(os, m.get_representation());
+		write_policy(os, policy, true);
+	}
+
+	void write_result(std::ostream &os, int result)
+	{
+		put8(os, RESULT_TAG);
+		put8(os, (uint8_t)(int8_t)result);
+	}
+
+	int replay(const uint16_t *moves, int n, int *boards, int *metadata, uint8_t *legal_moves, const std::string &start_fen)
+	{
+		Position p;
+		if (!start_fen.empty())
+			Position::set(start_fen, p);
+		std::vector<uint16_t> legal_indices;
+		for (int i = 0; i < n; i++)
+		{
+			write_position(p, (int(*)[COLS])(boards + i * ROWS * COLS), metadata + i * METADATA_LENGTH);
+			if (!play_legal(p, Move(moves[i]), legal_moves ? &legal_indices : nullptr))
+				return i;
+			if (legal_moves)
+			{
+				uint8_t *l = legal_moves + (size_t)i * ROWS * COLS * MOVES_PER_SQUARE;
+				memset(l, 0, ROWS * COLS * MOVES_PER_SQUARE);
+				for (uint16_t index : legal_indices)
+					l[index] = 1;
+			}
+		}
+		return n;
+	}
+
+	bool read_game(std::istream &is, std::vector<MoveRecord> &moves, int &result)
+	{
+		char magic[4];
+		uint16_t version;
+		uint8_t rows, cols, moves_per_square, metadata_length;
+		if (!is.read(magic, 4) || memcmp(magic, MAGIC, 4) != 0 || !get16(is, version) || version < MIN_VERSION || version > VERSION ||
+			!get8(is, rows) || !get8(is, cols) || !get8(is, moves_per_square) || !get8(is, metadata_length) ||
+			rows != ROWS || cols != COLS || moves_per_square != MOVES_PER_SQUARE || metadata_length != METADATA_LENGTH)
+			return false;
+
+		moves.clear();
+		Position p; // the position before the next move
+		std::vector<uint16_t> legal_indices;
+		uint8_t tag;
+		while (get8(is, tag))
+		{
+			if (tag == RESULT_TAG)
+			{
+				uint8_t r;
+				if (!get8(is, r))
+					return false;
+				result = (int8_t)r;
+				return true;
+			}
+
+			if (tag == START_TAG && version >= 3 && moves.empty())
+			{
+				uint8_t n;
+				std::string fen;
+				if (!get8(is, n))
+					return false;
+				fen.resize(n);
+				if (!is.read(&fen[0], n))
+					return false;
+				Position::set(fen, p);
+				continue;
+			}
+
+			MoveRecord rec;
+			if (tag == MOVE_TAG)
+			{
+				uint8_t buf[BOARD_BYTES + 5];
+				if (!is.read((char *)buf, sizeof(buf)))
+					return false;
+				for (int s = 0; s < ROWS * COLS; s++)
+					rec.board[s / COLS][s % COLS] = (buf[s / 2] >> (4 * (s % 2))) & 0xf;
+				for (int i = 0; i < 4; i++)
+					rec.metadata[i] = (buf[BOARD_BYTES] >> i) & 1;
+				rec.metadata[4] = buf[BOARD_BYTES + 1];
+				rec.move = Move(buf[BOARD_BYTES + 2] | (buf[BOARD_BYTES + 3] << 8));
+				rec.color = Color(buf[BOARD_BYTES + 4]);
+			}
+			else if (tag == COMPACT_MOVE_TAG && version >= 2)
+			{
+				uint16_t move;
+				if (!get16(is, move))
+					return false;
+				write_position(p, rec.board, rec.metadata);
+				rec.move = Move(move);
+				rec.color = p.turn();
+			}
+			else
+				return false;
+			if (!read_policy(is, rec.policy))
+				return false;
+			if (tag == MOVE_TAG && !play_legal(p, rec.move))
+				return false;
+			if (tag == COMPACT_MOVE_TAG)
+			{
+				// add back the legal moves that were left out, with probability 0, in policy index order.
+				if (!play_legal(p, rec.move, &legal_indices))
+					return false;
+				std::sort(legal_indices.begin(), legal_indices.end());
+				std::vector<std::pair<uint16_t, float>> policy;
+				policy.reserve(legal_indices.size());
+				size_t j = 0;
+				std::sort(rec.policy.begin(), rec.policy.end());
+				for (uint16_t index : legal_indices)
+				{
+					if (j < rec.policy.size() && rec.policy[j].first == index)
+						policy.push_back(rec.policy[j++]);
+					else
+						policy.emplace_back(index, 0.0f);
+				}
+				if (j != rec.policy.size()) // an entry for a move that is not legal
+					return false;
+				rec.policy = std::move(policy);
+			}
+			moves.push_back(std::move(rec));
+		}
+		return false;
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "Constants.h"
+#include "types.h"
+
+/*
+The binary format of a self-play game, written by MCTS when its record format is BINARY_RECORDS.
+All integers are little endian.
+
+header:		"CPGR", uint16 version, uint8 rows, uint8 cols, uint8 moves per square, uint8 metadata length
+then, for a game that does not begin at the start position (version 3):
+			uint8 'F', uint8 n, then the n characters of the FEN of its first position
+then one record per move:
+			uint8 'M'
+			32 bytes: the board as 4 bit pieces, square r * COLS + c in the low nibble of byte (r * COLS + c) / 2 if it is even
+			uint8 castling flags (bit i is metadata[i] for i < 4), uint8 en passant square (metadata[4])
+			uint16 the move played, uint8 the color to move
+			uint8 n, then n times: uint16 policy index (r * COLS * MOVES_PER_SQUARE + c * MOVES_PER_SQUARE + i),
+			uint16 probability * 65535, one for every legal move
+or, for games stored as moves only (version 2), one record per move:
+			uint8 'm', uint16 the move played, uint8 n, then n policy entries as above, only for the moves with a
+			nonzero probability
+and a trailer once the game is over:
+			uint8 'R', int8 result (1 white won, -1 black won, 0 draw)
+
+The board and metadata are as given by writePosition, so they are rotated for black.
+Moves only records leave them out, as well as the color and the legal moves that were never visited;
+they are recovered by replaying the moves from the first position of the game.
+A file may hold several games one after the other, each with its own header.
+*/
+namespace game_record
+{
+	const char MAGIC[4] = {'C', 'P', 'G', 'R'};
+	const uint16_t VERSION = 3;
+	const uint16_t MIN_VERSION = 1; // the oldest version that can still be read
+	const uint8_t MOVE_TAG = 'M';
+	const uint8_t COMPACT_MOVE_TAG = 'm';
+	const uint8_t RESULT_TAG = 'R';
+	const uint8_t START_TAG = 'F';
+	const int BOARD_BYTES = ROWS * COLS / 2;
+
+	// a move of a game as it is read back.
+	struct MoveRecord
+	{
+		int board[ROWS][COLS];
+		int metadata[METADATA_LENGTH];
+		std::vector<std::pair<uint16_t, float>> policy; // (policy index, probability) for every legal move
+		Move move;
+		Color color;
+	};
+
+	void write_header(std::ostream &os);
+
+	// writes the first position of a game that does not begin at the start position. must follow the header.
+	void write_start_position(std::ostream &os, const std::string &fen);
+
+	void write_move(std::ostream &os,
+					const int board[ROWS][COLS],
+					const int metadata[METADATA_LENGTH],
+					const std::vector<std::pair<uint16_t, float>> &policy,
+					Move m,
+					Color color);
+
+	// writes a move without its position. entries of policy whose probability rounds to 0 are left out.
+	void write_compact_move(std::ostream &os,
+							const std::vector<std::pair<uint16_t, float>> &policy,
+							Move m);
+
+	void write_result(std::ostream &os, int result);
+
+	// plays the n moves from start_fen, or from the start position if it is empty, and writes the position before each of them to boards[i] and metadata[i]
+	// (n * ROWS * COLS and n * METADATA_LENGTH ints), as seen by the side to move.
+	// if legal_moves is given (n * ROWS * COLS * MOVES_PER_SQUARE bytes), legal_moves[i] is set to 1 at the policy index
+	// of every legal move of the ith position and 0 elsewhere.
+	// returns the number of moves replayed, which is less than n if moves[result] is not legal.
+	int replay(const uint16_t *moves, int n, int *boards, int *metadata, uint8_t *legal_moves = nullptr,
+			   const std::string &start_fen = "");
+
+	// reads a whole game, replaying its moves to fill in the positions of moves only records.
+	// returns false if the stream is not a game of a readable version, the game has no result yet, or a move is illegal.
+	bool read_game(std::istream &is, std::vector<MoveRecord> &moves, int &result);
+}
@@ -0,0 +1,251 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <condition_variable>
+#include <stdint.h>
+
+/*
+An unbounded multi producer single consumer queue (Vyukov's linked list queue).
+push is lock free and may be called from any thread; pop may only be called from one thread at a time.
+pop can miss an element whose push has not finished yet; it shows up on a later pop.
+*/
+template <typename T>
+class MPSCQueue
+{
+private:
+	struct Node
+	{
+		std::atomic<Node *> next;
+		T value;
+		Node() : next(nullptr) {}
+		Node(T &&v) : next(nullptr), value(std::move(v)) {}
+	};
+	std::atomic<Node *> head; // the last pushed node; producers swap themselves in here
+	Node *tail;				  // a dummy node; tail->next is the next node to pop
+
+public:
+	MPSCQueue() : head(new Node()), tail(head.load()) {}
+
+	MPSCQueue(const MPSCQueue &other) = delete;
+	MPSCQueue &operator=(const MPSCQueue &other) = delete;
+
+	~MPSCQueue()
+	{
+		T dummy;
+		while (pop(dummy))
+			;
+		delete tail;
+	}
+
+	inline void push(T value)
+	{
+		Node *n = new Node(std::move(value));
+		Node *prev = head.exchange(n, std::memory_order_acq_rel);
+		prev->next.store(n, std::memory_order_release);
+	}
+
+	inline bool pop(T &out)
+	{
+		Node *next = tail->next.load(std::memory_order_acquire);
+		if (next == nullptr)
+			return false;
+		out = std::move(next->value);
+		delete tail;
+		tail = next;
+		return true;
+	}
+};
+
+/*
+Writes finished games to a few sharded files on a background thread, so trees never touch the filesystem.
+A game is handed over as one string holding its whole record (see GameRecord.h), and games are appended to the
+shards in turn. Each shard collects games in memory and writes them in chunks of chunk_bytes. Once a shard file holds
+file_bytes bytes it is closed and the next one is opened: shard k writes base_k_time_0, base_k_time_1, ...
+so, like the per game files before, every file except the last of each shard is complete.
+*/
+class GameWriter
+{
+private:
+	struct Shard
+	{
+		std::ofstream file;
+		std::string buffer;
+		uint64_t file_size = 0;
+		int file_num = 0;
+	};
+
+	std::string base;
+	std::string timestamp;
+	size_t const chunk_bytes;
+	uint64_t const file_bytes;
+	std::vector<Shard> shards;
+	int next_shard = 0;
+
+	MPSCQueue<std::string> queue;
+	std::atomic<uint64_t> pushed; // games pushed so far
+	uint64_t popped = 0;		  // games taken off the queue; only touched by the writer thread
+
+	std::mutex m;
+	std::condition_variable wake;	   // notified when a game is pushed to a sleeping writer, a flush is requested or the writer is dying
+	std::atomic<bool> sleeping{false}; // whether the writer waits on wake; see push
+	std::condition_variable flushed_cv; // notified when a flush is done
+	uint64_t flush_target = 0;		   // flush() waits until the first flush_target games are on disk
+	uint64_t flushed = 0;
+	bool rotate_requested = false;	   // whether the pending flush also starts new files
+	bool alive = true;
+	std::thread writer;
+
+	inline void open(Shard &s, int k)
+	{
+		s.file.open(file_name(k, s.file_num), std::ios::out | std::ios::binary);
+		s.file_size = 0;
+	}
+
+	// closes the file of shard k and opens its next one.
+	inline void rotate(Shard &s, int k)
+	{
+		s.file.close();
+		s.file_num++;
+		open(s, k);
+	}
+
+	inline void write(Shard &s, int k)
+	{
+		if (s.buffer.empty())
+			return;
+		s.file.write(s.buffer.data(), s.buffer.size());
+		s.file_size += s.buffer.size();
+		s.buffer.clear();
+		if (s.file_size >= file_bytes)
+			rotate(s, k);
+	}
+
+	void writer_loop()
+	{
+		std::string game;
+		std::unique_lock<std::mutex> lock(m, std::defer_lock);
+		while (true)
+		{
+			bool any = false;
+			while (queue.pop(game))
+			{
+				int k = next_shard;
+				next_shard = (next_shard + 1) % (int)shards.size();
+				shards[k].buffer += game;
+				if (shards[k].buffer.size() >= chunk_bytes)
+					write(shards[k], k);
+				popped++;
+				any = true;
+			}
+
+			lock.lock();
+			if ((flush_target > flushed || rotate_requested) && popped >= flush_target)
+			{
+				for (int k = 0; k < (int)shards.size(); k++)
+				{
+					write(shards[k], k);
+					if (rotate_requested && shards[k].file_size > 0)
+						rotate(shards[k], k);
+					else
+						shards[k].file.flush();
+				}
+				rotate_requested = false;
+				flushed = popped;
+				flushed_cv.notify_all();
+			}
+			if (!alive && popped == pushed.load())
+				break;
+			if (!any)
+			{
+				// push reads sleeping after counting its game, so either the game is counted here or push wakes us.
+				sleeping = true;
+				wake.wait(lock, [&]
+						  { return !alive || pushed.load() > popped || flush_target > flushed || rotate_requested; });
+				sleeping = false;
+			}
+			lock.unlock();
+		}
+		lock.unlock();
+		for (int k = 0; k < (int)shards.size(); k++)
+		{
+			write(shards[k], k);
+			shards[k].file.close();
+		}
+	}
+
+public:
+	GameWriter(std::string base,
+			   int num_shards,
+			   size_t chunk_bytes = 1 << 20,
+			   uint64_t file_bytes = 64ULL << 20) : base(base),
+													timestamp(std::to_string((long)std::chrono::system_clock::now().time_since_epoch().count())),
+													chunk_bytes(chunk_bytes),
+													file_bytes(file_bytes),
+													shards(std::max(num_shards, 1)),
+													pushed(0)
+	{
+		for (int k = 0; k < (int)shards.size(); k++)
+			open(shards[k], k);
+		writer = std::thread(&GameWriter::writer_loop, this);
+	}
+
+	GameWriter(const GameWriter &other) = delete;
+	GameWriter &operator=(const GameWriter &other) = delete;
+
+	// writes out every game pushed so far.
+	~GameWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			alive = false;
+		}
+		wake.notify_all();
+		writer.join();
+	}
+
+	// hands a finished game to the writer. threadsafe, and lock free unless the writer has nothing to do and sleeps.
+	inline void push(std::string game)
+	{
+		queue.push(std::move(game));
+		pushed.fetch_add(1);
+		if (sleeping.load())
+		{
+			// taking the lock makes sure the writer is waiting, not between its check and the wait.
+			std::lock_guard<std::mutex> lock(m);
+			wake.notify_one();
+		}
+	}
+
+	// blocks until every game pushed before the call is written to its file.
+	// if rotate is true, the shards also close their files and move on to new ones, so every game written so far
+	// is in a complete file.
+	void flush(bool rotate = false)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		uint64_t target = pushed.load();
+		// games flushed earlier without a rotation may still be in open files.
+		if (target <= flushed && !rotate)
+			return;
+		flush_target = std::max(flush_target, target);
+		rotate_requested |= rotate;
+		wake.notify_all();
+		flushed_cv.wait(lock, [&]
+						{ return flushed >= target && !(rotate && rotate_requested); });
+	}
+
+	inline int num_shards() { return (int)shards.size(); }
+
+	// the name of the file_num-th file of shard k
+	inline std::string file_name(int k, int file_num)
+	{
+		return base + "_" + std::to_string(k) + "_" + timestamp + "_" + std::to_string(file_num);
+	}
+
+	inline uint64_t games_pushed() { return pushed.load(); }
+};
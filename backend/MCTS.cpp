@@ -13,15 +13,13 @@ float rand_num(float s, float l)
 	return f;
 }
 
-// array must be initialized to all zeros
-template <Color color>
-void writeLegalMoves(Position &p, LegalMoves &legal_moves)
+// array must be initialized to all zeros. node must be expanded at p, so that the legal moves are not generated again.
+void writeLegalMoves(Position &p, MCTSNode &node, LegalMoves &legal_moves)
 {
-	MoveList<color> l(p);
 	PolicyIndex i;
-	for (Move m : l)
+	for (size_t k = 0; k < node.get_num_children(); k++)
 	{
-		move2index(p, m, color, i);
+		move2index(p, node.get_child_move(k), node.get_color(), i);
 		legal_moves.l[i.r][i.c][i.i] = 1;
 	}
 }
@@ -55,8 +53,9 @@ void move2index(const Position &p, Move m, Color color, PolicyIndex &policyIndex
 
 MCTSNode *MCTSNode::add_leaf(MemoryManager &m)
 {
+	if (!reallocate_memory(m))
+		return nullptr;
 	num_expanded++;
-	reallocate_memory(m);
 	get_node_at(num_expanded - 1) = MCTSNode(~get_color());
 
 	return begin_nodes() + num_expanded - 1;
@@ -67,7 +66,10 @@ void MCTSNode::select_best_child(const float cpuct, std::pair<MCTSNode *, Move>
 	MCTSNode *res = nullptr;
 	Move best_move(0);
 	float best(-FLT_MAX);
-	float start(cpuct * std::sqrt((float)get_num_times_selected()));
+	MCTSNode *best_expanded = nullptr; // used if the best leaf cannot be added
+	Move best_expanded_move(0);
+	float best_expanded_u(-FLT_MAX);
+	float start(cpuct * std::sqrt((float)(get_num_times_selected() + virtual_loss)));
 	float u;
 	if (num_expanded < num_children)
 	{
@@ -78,8 +80,20 @@ void MCTSNode::select_best_child(const float cpuct, std::pair<MCTSNode *, Move>
 	for (int i = 0; i < num_expanded; i++)
 	{
 		// mean q is evaluated for the other side; we want to minimize the other side's success.
+		// pending selections count as visits that the other side won.
 		MCTSNode &a = get_node_at(i);
-		u = start * get_prob_at(i) / (1.0f + a.get_num_times_selected()) - a.get_mean_q();
+		// a move proven to lose is never searched again.
+		if (a.is_proven() && a.get_proven_value() == 1)
+			continue;
+		uint32_t n = a.get_num_times_selected() + a.virtual_loss;
+		float mean_q = n > 0 ? (a.q + a.virtual_loss) / n : 0.0f;
+		u = start * get_prob_at(i) / (1.0f + n) - mean_q;
+		if (u > best_expanded_u)
+		{
+			best_expanded_u = u;
+			best_expanded = &a;
+			best_expanded_move = get_move_at(i);
+		}
 		if (u > best)
 		{
 			best = u;
@@ -93,6 +107,10 @@ void MCTSNode::select_best_child(const float cpuct, std::pair<MCTSNode *, Move>
 	{
 		// the best leaf won!
 		res = add_leaf(m);
+		// out of memory: the tree stops growing here and the best expanded child is searched instead.
+		if (res == nullptr)
+			best_move = best_expanded_move;
+		res = res ? res : best_expanded;
 	}
 	child.first = res;
 	child.second = best_move;
@@ -154,8 +172,55 @@ std::pair<MCTSNode *, Move> MCTSNode::select_best_child_by_count(float temperatu
 	return std::pair<MCTSNode *, Move>(begin_nodes() + num_expanded - 1, get_move_at(num_expanded - 1));
 }
 
+bool MCTSNode::update_proven()
+{
+	if (is_proven())
+		return true;
+	if (num_expanded == 0)
+		return false;
+	bool all_proven = num_expanded == num_children;
+	int best = -1;
+	for (int i = 0; i < num_expanded; i++)
+	{
+		MCTSNode &child = get_node_at(i);
+		if (!child.is_proven())
+		{
+			all_proven = false;
+			continue;
+		}
+		best = std::max(best, -child.get_proven_value());
+		if (best == 1)
+			break;
+	}
+	if (best < 1 && !all_proven)
+		return false;
+	// bits 2-3 only: the node keeps its children and is not a terminal position.
+	color_itp = (color_itp & 3u) | ((best + 2) << 2);
+	return true;
+}
+
+std::pair<MCTSNode *, Move> MCTSNode::select_proven_child()
+{
+	int res = -1;
+	if (is_proven())
+	{
+		for (int i = 0; i < num_expanded; i++)
+		{
+			MCTSNode &child = get_node_at(i);
+			if (child.is_proven() && -child.get_proven_value() == get_proven_value() &&
+				(res < 0 || child.get_num_times_selected() > get_node_at(res).get_num_times_selected()))
+				res = i;
+		}
+	}
+	if (res < 0)
+		return std::pair<MCTSNode *, Move>(nullptr, 0);
+	return std::pair<MCTSNode *, Move>(begin_nodes() + res, get_move_at(res));
+}
+
 float MCTSNode::minimax_evaluation()
 {
+	if (is_proven())
+		return (float)get_proven_value();
 	if (num_expanded == 0) // we don't want to do minimax if we have no children, or all the children are leaves.
 		return get_mean_q();
 	else
@@ -185,7 +250,8 @@ void MCTSNode::expand(
 	{
 		// first, initialize the memory for children
 		num_children = (uint8_t)size;
-		init_memory(m);
+		if (!init_memory(m))
+			return;
 
 		float tot = 0;
 		PolicyIndex policyIndex;
@@ -208,6 +274,16 @@ void MCTSNode::expand(
 	}
 }
 
+void MCTSNode::expand(const uint8_t *cached_children, size_t size, MemoryManager &m)
+{
+	if (!is_terminal_position() && is_leaf() && size > 0)
+	{
+		num_children = (uint8_t)size;
+		if (init_memory(m))
+			memcpy(children, cached_children, 3 * size);
+	}
+}
+
 void MCTSNode::backup(float q)
 {
 	num_times_selected++;
@@ -216,9 +292,37 @@ void MCTSNode::backup(float q)
 
 void MCTS::add_move(BoardState &board_state, Policy &policy, LegalMoves &legal_moves, Move &m, Color &c)
 {
-	if (output.is_open())
+	ostream *out = record_stream();
+	if ((out != nullptr && record_format != TEXT_RECORDS) || replay_buffer)
 	{
-		output << board_state << "\n";
+		record_policy.clear();
+		for (int r = 0; r < ROWS; r++)
+			for (int c = 0; c < COLS; c++)
+				for (int i = 0; i < MOVES_PER_SQUARE; i++)
+					if (legal_moves.l[r][c][i])
+						record_policy.emplace_back(r * COLS * MOVES_PER_SQUARE + c * MOVES_PER_SQUARE + i, policy.p[r][c][i]);
+	}
+	if (replay_buffer)
+	{
+		replay_moves.emplace_back();
+		game_record::MoveRecord &rec = replay_moves.back();
+		memcpy(rec.board, board_state.b, sizeof(rec.board));
+		memcpy(rec.metadata, board_state.m, sizeof(rec.metadata));
+		rec.policy = record_policy;
+		rec.move = m;
+		rec.color = c;
+	}
+	if (out != nullptr && record_format != TEXT_RECORDS)
+	{
+		// no flush: the game is flushed once it is over.
+		if (record_format == MOVES_ONLY_RECORDS)
+			game_record::write_compact_move(*out, record_policy, m);
+		else
+			game_record::write_move(*out, board_state.b, board_state.m, record_policy, m, c);
+	}
+	else if (out != nullptr)
+	{
+		*out << board_state << "\n";
 		for (int r = 0; r < ROWS; r++)
 		{
 			for (int c = 0; c < COLS; c++)
@@ -227,15 +331,16 @@ void MCTS::add_move(BoardState &board_state, Policy &policy, LegalMoves &legal_m
 				{
 					if (legal_moves.l[r][c][i])
 					{
-						output << r << "," << c << "," << i << "," << policy.p[r][c][i] << ",";
+						*out << r << "," << c << "," << i << "," << policy.p[r][c][i] << ",";
 					}
 				}
 			}
 		}
-		output << "\n";
-		output << m << "\n";
-		output << c << "\n";
-		output.flush();
+		*out << "\n";
+		*out << m << "\n";
+		*out << c << "\n";
+		if (!buffered_game)
+			out->flush();
 	}
 	move_num++;
 }
@@ -243,11 +348,26 @@ void MCTS::add_move(BoardState &board_state, Policy &policy, LegalMoves &legal_m
 void MCTS::declare_winner(float c)
 {
 	long res = std::lround(c);
-	if (output.is_open())
+	if (replay_buffer)
+	{
+		replay_buffer->add_game(replay_moves, (int)res);
+		replay_moves.clear();
+	}
+	ostream *out = record_stream();
+	if (out == nullptr)
+		return;
+	if (record_format != TEXT_RECORDS)
+		game_record::write_result(*out, (int)res);
+	else
+		*out << res << " WINNER!\n";
+	if (buffered_game)
 	{
-		output << res << " WINNER!\n";
-		output.flush();
+		game_writer->push(game_buffer.str());
+		game_buffer.str("");
+		buffered_game = false;
 	}
+	else
+		out->flush();
 }
 
 void MCTS::new_game()
@@ -259,10 +379,13 @@ void MCTS::new_game()
 	best_leaf_path.clear();
 	best_leaf_path.reserve(200);
 	p = Position();
+	invalidate_snapshots();
 	temperature = default_temp;
 	game_num++;
 	move_num = 1;
 	tablebase_eval = 2;
+	replay_moves.clear();
+	start_fen.clear();
 	update_output();
 }
 
@@ -287,80 +410,370 @@ size_t MCTSNode::size()
 bool MCTS::select(const float cpuct, Ndarray<int, 2> board, Ndarray<int, 1> metadata)
 {
 
-	// first, check if we have enough memory
-	while (memory_manager->memory_until_wall() <= max_possible_allocation_request)
+	float cached_q;
+	while (true)
 	{
-		int64_t diff = memory_manager->resize(memory_manager->size() * 2);
-		if (diff != 0)
-			shift_tree(root, diff);
+		MCTSNode *cur = root;
+		best_leaf_path.emplace_back(cur, 0);
+		std::pair<MCTSNode *, Move> child(0, 0);
+		// a proven node below the root is not searched further; its value is backed up as is.
+		while (!(cur->is_leaf()) && (cur == root || !cur->is_proven()))
+		{
+			cur->select_best_child(cpuct, child, *memory_manager);
+			// out of memory and nothing expanded below cur: cur is evaluated again instead.
+			if (!child.first)
+				break;
+			best_leaf_path.emplace_back(child.first, child.second);
+
+			cur = child.first;
+		}
+		follow_path(best_leaf_path, 1);
+		best_leaf = cur;
+		// check if our leaf is a terminal position. If so, mark it.
+		detect_terminal(best_leaf, moves, nmoves);
+
+		// proven positions and transpositions are resolved right away and we select again.
+		// the last simulation before the sim limit, or the first one after the root is proven, always goes through
+		// update() so that auto play still happens there; a proven position is then evaluated there as a terminal one.
+		bool proven = probe_leaf(best_leaf, cached_q);
+		if (root->get_num_times_selected() + 1 < sim_limit && !play_proven_root() && (proven || expand_from_table(best_leaf, cached_q)))
+			backup_best_leaf_path(cached_q, best_leaf->get_color());
+		else
+			break;
+	}
+	if (best_leaf->get_color() == WHITE)
+	{
+		writePosition<WHITE>(p, board, metadata);
+	}
+	else if (best_leaf->get_color() == BLACK)
+	{
+		writePosition<BLACK>(p, board, metadata);
 	}
+	return best_leaf->is_terminal_position() || best_leaf->is_proven();
+}
+
+MCTSNode *MCTS::select_leaf_path(const float cpuct, int i)
+{
+	vector<pair<int, Move>> &path = leaf_paths[i];
+	path.clear();
 	MCTSNode *cur = root;
-	best_leaf_path.emplace_back(cur, 0);
+	cur->add_virtual_loss();
 	std::pair<MCTSNode *, Move> child(0, 0);
-	while (!(cur->is_leaf()))
+	while (!(cur->is_leaf()) && (cur == root || !cur->is_proven()))
 	{
 		cur->select_best_child(cpuct, child, *memory_manager);
-		if (cur->get_color() == WHITE)
-			p.play<WHITE>(child.second);
-		else
-			p.play<BLACK>(child.second);
-		best_leaf_path.emplace_back(child.first, child.second);
-
+		if (!child.first)
+			break;
+		path.emplace_back((int)(child.first - cur->begin_nodes()), child.second);
 		cur = child.first;
+		cur->add_virtual_loss();
 	}
-	best_leaf = cur;
-	if (!best_leaf->is_terminal_position())
+	return cur;
+}
+
+template <typename Path>
+void MCTS::follow_path(const Path &path, size_t first)
+{
+	size_t n = path.size() - first;
+	size_t depth = 0;
+	if (next_snapshot_stride != snapshot_stride)
 	{
-		// check if our leaf is a terminal position. If so, mark it.
-		bool itp(false);
-		if (best_leaf->get_color() == WHITE)
+		// without a snapshot of the root, p is already there.
+		if (snapshot_stride > 0 && num_snapshots > 0)
+			p.restore(snapshots[0]);
+		snapshot_stride = next_snapshot_stride;
+		invalidate_snapshots();
+	}
+	if (snapshot_stride > 0)
+	{
+		if (num_snapshots == 0)
 		{
-			Move *last = p.generate_legals<WHITE>(moves);
-			nmoves = last - moves;
-			if (nmoves == 0)
-				itp = true;
+			if (snapshots.empty())
+				snapshots.emplace_back();
+			p.save(snapshots[0]);
+			num_snapshots = 1;
 		}
+		size_t common = 0;
+		size_t limit = std::min(n, snapshot_path.size());
+		while (common < limit && path[first + common].second.to_from() == snapshot_path[common].to_from())
+			common++;
+		int k = std::min((int)(common / snapshot_stride), num_snapshots - 1);
+		p.restore(snapshots[k]);
+		num_snapshots = k + 1;
+		depth = (size_t)k * snapshot_stride;
+		snapshot_path.resize(depth);
+	}
+	Color c = depth % 2 == 0 ? root->get_color() : ~root->get_color();
+	for (; depth < n; depth++)
+	{
+		Move m = path[first + depth].second;
+		if (c == WHITE)
+			p.play<WHITE>(m);
 		else
+			p.play<BLACK>(m);
+		c = ~c;
+		if (snapshot_stride > 0)
 		{
-			Move *last = p.generate_legals<BLACK>(moves);
-			nmoves = last - moves;
-			if (nmoves == 0)
-				itp = true;
+			snapshot_path.push_back(m);
+			if ((depth + 1) % snapshot_stride == 0)
+			{
+				if ((int)snapshots.size() == num_snapshots)
+					snapshots.emplace_back();
+				p.save(snapshots[num_snapshots++]);
+			}
 		}
-		if (itp)
-			best_leaf->mark_terminal_position();
 	}
-	if (best_leaf->get_color() == WHITE)
+}
+
+template <typename Path>
+void MCTS::return_to_root(const Path &path, size_t first)
+{
+	if (snapshot_stride > 0)
 	{
-		writePosition<WHITE>(p, board, metadata);
+		p.restore(snapshots[0]);
+		return;
 	}
-	else if (best_leaf->get_color() == BLACK)
+	// the color of the node reached after path[j] is the opposite of the color that played path[j].
+	Color c = (path.size() - first) % 2 == 0 ? root->get_color() : ~root->get_color();
+	for (size_t j = path.size(); j > first; j--)
 	{
-		writePosition<BLACK>(p, board, metadata);
+		if (c == WHITE)
+			p.undo<BLACK>(path[j - 1].second);
+		else
+			p.undo<WHITE>(path[j - 1].second);
+		c = ~c;
 	}
-	return best_leaf->is_terminal_position();
 }
 
-// resets the invariants after a call to select()
-// to make it seem like it never happened!
-void MCTS::undo_select()
+void MCTS::replay_leaf_path(int i)
+{
+	collect_leaf_path_nodes(i);
+	follow_path(leaf_paths[i], 0);
+}
+
+void MCTS::collect_leaf_path_nodes(int i)
+{
+	path_nodes.clear();
+	MCTSNode *cur = root;
+	path_nodes.push_back(cur);
+	for (const auto &edge : leaf_paths[i])
+	{
+		cur = cur->begin_nodes() + edge.first;
+		path_nodes.push_back(cur);
+	}
+}
+
+bool MCTS::expand_from_table(MCTSNode *leaf, float &q)
+{
+	if (!transposition_table || !leaf->is_leaf() || leaf->is_terminal_position())
+		return false;
+	TTEntry entry;
+	if (!transposition_table->probe(p.key(), entry))
+		return false;
+	leaf->expand(entry.children, entry.num_children, *memory_manager);
+	q = entry.q;
+	return true;
+}
+
+bool MCTS::probe_leaf(MCTSNode *leaf, float &q)
 {
+	if (leaf->is_proven())
+	{
+		q = (float)leaf->get_proven_value();
+		return true;
+	}
+	// the root is left alone: its children still have to be searched to pick a move.
+	if (leaf == root || !leaf->is_leaf() || leaf->is_terminal_position())
+		return false;
+	int val;
+	if (!(tablebase_cache ? tablebase_cache->probe_wdl(&val, p) : probe_wdl(&val, p)))
+		return false;
+	int leaf_val = leaf->get_color() == WHITE ? val : -val;
+	leaf->mark_proven(leaf_val);
+	q = (float)leaf_val;
+	return true;
+}
+
+float MCTS::terminal_value(MCTSNode *leaf)
+{
+	if (leaf->is_proven())
+		return (float)leaf->get_proven_value();
+	float val = evaluateTerminalPosition(p);
+	return leaf->get_color() == BLACK ? -val : val;
+}
+
+void MCTS::store_in_table(MCTSNode *leaf, float q)
+{
+	if (transposition_table && leaf->get_num_expanded() == 0)
+		transposition_table->store(p.key(), q, leaf->begin_children(), leaf->get_num_children());
+}
+
+void MCTS::propagate_proven()
+{
+	for (auto it = path_nodes.rbegin(); it != path_nodes.rend() && (*it)->update_proven(); it++)
+		;
+}
+
+void MCTS::backup_best_leaf_path(float val, Color best_leaf_color)
+{
+	// a proven leaf may prove its ancestors, from the bottom up. the first one that is not proven stops it.
+	for (auto it = best_leaf_path.rbegin(); it != best_leaf_path.rend() && it->first->update_proven(); it++)
+		;
 	best_leaf = nullptr;
-	Move m;
-	MCTSNode *cur;
-	while (!best_leaf_path.empty())
-	{
-		cur = best_leaf_path.back().first;
-		m = best_leaf_path.back().second;
-		best_leaf_path.pop_back();
-		if (cur != root)
+	for (auto &entry : best_leaf_path)
+		entry.first->backup(entry.first->get_color() == best_leaf_color ? val : -1.0f * val);
+	return_to_root(best_leaf_path, 1);
+	best_leaf_path.clear();
+}
+
+void MCTS::revert_leaf_path(int i)
+{
+	MCTSNode *cur = root;
+	cur->revert_virtual_loss();
+	for (const auto &edge : leaf_paths[i])
+	{
+		cur = cur->begin_nodes() + edge.first;
+		cur->revert_virtual_loss();
+	}
+}
+
+void MCTS::unwind_leaf_path(int i)
+{
+	return_to_root(leaf_paths[i], 0);
+}
+
+int MCTS::select(const float cpuct, Ndarray<int, 3> boards, Ndarray<int, 2> metadata, int offset)
+{
+	if (leaves_per_round == 1)
+	{
+		select(cpuct, boards[offset], metadata[offset]);
+		return 1;
+	}
+
+	num_leaf_paths = 0;
+	int collisions = 0;
+	float cached_q;
+	while (num_leaf_paths < leaves_per_round && collisions < leaves_per_round)
+	{
+		// never hand out more leaves than there are simulations left before the move is played.
+		uint64_t pending = root->get_num_times_selected() + num_leaf_paths;
+		if (num_leaf_paths > 0 && (pending >= sim_limit || play_proven_root()))
+			break;
+		int i = num_leaf_paths;
+		MCTSNode *leaf = select_leaf_path(cpuct, i);
+		if (leaf->get_virtual_loss() > 1 && !leaf->is_terminal_position() && !leaf->is_proven())
+		{
+			// collision: an earlier path of this round is already waiting on this leaf's evaluation.
+			revert_leaf_path(i);
+			collisions++;
+			continue;
+		}
+		follow_path(leaf_paths[i], 0);
+		detect_terminal(leaf, moves + i * MAX_MOVES, leaf_nmoves[i]);
+		bool proven = probe_leaf(leaf, cached_q);
+		if (pending + 1 < sim_limit && !play_proven_root() && (proven || expand_from_table(leaf, cached_q)))
+		{
+			// proven position or transposition: resolve it without taking up a slot.
+			collect_leaf_path_nodes(i);
+			Color leaf_color = leaf->get_color();
+			for (MCTSNode *node : path_nodes)
+			{
+				node->revert_virtual_loss();
+				node->backup(node->get_color() == leaf_color ? cached_q : -1.0f * cached_q);
+			}
+			propagate_proven();
+			unwind_leaf_path(i);
+			continue;
+		}
+		if (leaf->is_terminal_position() || leaf->is_proven())
+			leaf_nmoves[i] = 0;
+		Ndarray<int, 2> board = boards[offset + i];
+		Ndarray<int, 1> meta = metadata[offset + i];
+		if (leaf->get_color() == WHITE)
+			writePosition<WHITE>(p, board, meta);
+		else
+			writePosition<BLACK>(p, board, meta);
+		unwind_leaf_path(i);
+		num_leaf_paths++;
+	}
+
+	// pad the unused slots with the root position.
+	for (int i = num_leaf_paths; i < leaves_per_round; i++)
+	{
+		Ndarray<int, 2> board = boards[offset + i];
+		Ndarray<int, 1> meta = metadata[offset + i];
+		if (root->get_color() == WHITE)
+			writePosition<WHITE>(p, board, meta);
+		else
+			writePosition<BLACK>(p, board, meta);
+	}
+	return num_leaf_paths;
+}
+
+void MCTS::update(Ndarray<float, 1> q, Ndarray<float, 4> policy, int offset)
+{
+	if (leaves_per_round == 1)
+	{
+		update(q[offset], policy[offset]);
+		return;
+	}
+
+	if (root->get_num_times_selected() + num_leaf_paths > sim_limit && auto_play)
+	{
+		std::string err = "somehow went over max-sim_limit with auto-play enabled. should be impossible!";
+		std::cout << err << "\n";
+		throw runtime_error(err);
+	}
+
+	for (int i = 0; i < num_leaf_paths; i++)
+	{
+		replay_leaf_path(i);
+		for (MCTSNode *node : path_nodes)
+			node->revert_virtual_loss();
+
+		// if auto-play is disabled and we reach the sim limit, the evaluation is thrown away.
+		if (root->get_num_times_selected() < sim_limit || auto_play)
 		{
-			if (cur->get_color() == WHITE)
-				p.undo<BLACK>(m);
-			else
-				p.undo<WHITE>(m);
+			MCTSNode *leaf = path_nodes.back();
+			float val = q[offset + i];
+			if (leaf->is_terminal_position() || leaf->is_proven())
+				val = terminal_value(leaf);
+			else if (leaf_nmoves[i] > 0)
+			{
+				Ndarray<float, 3> leaf_policy = policy[offset + i];
+				leaf->expand(p, leaf_policy, moves + i * MAX_MOVES, leaf_nmoves[i], leaves, *memory_manager);
+				store_in_table(leaf, val);
+			}
+
+			Color leaf_color = leaf->get_color();
+			for (MCTSNode *node : path_nodes)
+				node->backup(node->get_color() == leaf_color ? val : -1.0f * val);
+			propagate_proven();
 		}
+		unwind_leaf_path(i);
 	}
+	num_leaf_paths = 0;
+
+	// a proven root is played right away. if the next root is proven too, it is played by the next update().
+	if (play_proven_root())
+		play_best_move();
+	// if the the root's visit count is equal to the number of sim_limit, we need to play our move.
+	while (root->get_num_times_selected() >= sim_limit && auto_play)
+		play_best_move();
+}
+
+// resets the invariants after a call to select()
+// to make it seem like it never happened!
+void MCTS::undo_select()
+{
+	for (int i = 0; i < num_leaf_paths; i++)
+		revert_leaf_path(i);
+	num_leaf_paths = 0;
+
+	best_leaf = nullptr;
+	if (!best_leaf_path.empty())
+		return_to_root(best_leaf_path, 1);
+	best_leaf_path.clear();
 }
 
 void MCTS::play_best_move()
@@ -371,6 +784,13 @@ void MCTS::play_best_move()
 		// only can happen when autoplay disabled
 		return;
 	}
+	// a proven root plays the move that achieves its value. a proven win is recorded as that move alone,
+	// since the visits may be few if the root was proven early.
+	pair<MCTSNode *, Move> best_child = root->select_proven_child();
+	bool proven_win = best_child.first && root->get_proven_value() == 1;
+	if (!best_child.first)
+		best_child = root->select_best_child_by_count(temperature);
+
 	Policy policy;
 	vector<pair<Move, float>> policy_vec = root->policy(temperature);
 	PolicyIndex pidx;
@@ -378,6 +798,8 @@ void MCTS::play_best_move()
 	{
 		Move move = move_and_prob.first;
 		float prob = move_and_prob.second;
+		if (proven_win)
+			prob = move.get_representation() == best_child.second.get_representation() ? 1.0f : 0.0f;
 		if (root->get_color() == WHITE)
 			move2index(p, move, WHITE, pidx);
 		else
@@ -386,10 +808,7 @@ void MCTS::play_best_move()
 	}
 	// write the legal moves;
 	LegalMoves legal_moves;
-	if (root->get_color() == WHITE)
-		writeLegalMoves<WHITE>(p, legal_moves);
-	else
-		writeLegalMoves<BLACK>(p, legal_moves);
+	writeLegalMoves(p, *root, legal_moves);
 
 	// now, write the board state.
 	BoardState board_state;
@@ -399,16 +818,23 @@ void MCTS::play_best_move()
 		writePosition<BLACK>(p, board_state.b, board_state.m);
 
 	// update the board position
-	pair<MCTSNode *, Move> best_child = root->select_best_child_by_count(temperature);
 	Move m = best_child.second;
 	Color root_color = root->get_color();
 	if (root_color == WHITE)
 		p.play<WHITE>(m);
 	else
 		p.play<BLACK>(m);
+	invalidate_snapshots();
 	MCTSNode *newroot = new MCTSNode(*(best_child.first)); // shallow copy the best child
 	MCTSNode::recursive_delete(*root, best_child.first, true, *memory_manager);
 	root = newroot;
+	// a proven leaf is decided by the root probe below instead, which knows the 50 move counter, unless it has no moves.
+	// a proven inner node stays proven, so that auto play follows the proof.
+	if (root->is_leaf() && root->is_proven())
+	{
+		root->clear_proven();
+		detect_terminal(root);
+	}
 
 	// add the move to the game.
 	add_move(board_state, policy, legal_moves, m, root_color);
@@ -420,7 +846,7 @@ void MCTS::play_best_move()
 
 	// check tablebase for terminal position
 	int val;
-	if (probe(&val, p.fen()))
+	if (tablebase_cache ? tablebase_cache->probe(&val, p) : probe(&val, p))
 	{
 		tablebase_eval = val;
 	}
@@ -458,38 +884,23 @@ void MCTS::update(const float q, Ndarray<float, 3> policy)
 	}
 
 	float val = q;
-	if (best_leaf->is_terminal_position())
-	{
-		// p is at terminal position
-		val = evaluateTerminalPosition(p);
-		if (best_leaf->get_color() == BLACK)
-			val *= -1;
-	}
+	bool decided = best_leaf->is_terminal_position() || best_leaf->is_proven();
+	if (decided)
+		val = terminal_value(best_leaf); // p is at terminal position, or its value is proven
 
 	Color best_leaf_color = best_leaf->get_color();
-	if (nmoves > 0)
+	if (nmoves > 0 && !decided)
+	{
 		best_leaf->expand(p, policy, moves, nmoves, leaves, *memory_manager);
-
-	best_leaf = nullptr;
+		store_in_table(best_leaf, val);
+	}
 
 	// backpropagate the q value.
-	MCTSNode *cur;
-	Move m;
-	while (!best_leaf_path.empty())
-	{
-		cur = best_leaf_path.back().first;
-		m = best_leaf_path.back().second;
-		best_leaf_path.pop_back();
-		cur->backup(cur->get_color() == best_leaf_color ? val : -1.0f * val);
-		if (cur != root)
-		{
-			if (cur->get_color() == WHITE)
-				p.undo<BLACK>(m);
-			else
-				p.undo<WHITE>(m);
-		}
-	}
+	backup_best_leaf_path(val, best_leaf_color);
 
+	// a proven root is played right away. if the next root is proven too, it is played by the next update().
+	if (play_proven_root())
+		play_best_move();
 	// if the the root's visit count is equal to the number of sim_limit, we need to play our move.
 	while (root->get_num_times_selected() >= sim_limit && auto_play)
 		play_best_move();
@@ -557,6 +968,7 @@ ostream &operator<<(ostream &os, const BoardState &b)
 	return os;
 }
 
+int const MCTS::max_leaves_per_round = 255;
+int const MCTS::default_snapshot_stride = 4;
 uint32_t const MCTS::default_block_size = 1280000;
 uint32_t const MCTS::default_starting_size = 150;
-uint32_t const MCTS::max_possible_allocation_request = MAX_MOVES * (3 + sizeof(MCTSNode) + 3) * 2;
\ No newline at end of file
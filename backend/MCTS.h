@@ -5,6 +5,7 @@
 #include <ctime>
 #include <cmath>
 #include <fstream>
+#include <sstream>
 #include <unordered_set>
 #include <memory>
 #include "Constants.h"
@@ -12,6 +13,10 @@
 #include "tables.h"
 #include "float.h"
 #include "memmanager.h"
+#include "TranspositionTable.h"
+#include "GameRecord.h"
+#include "GameWriter.h"
+#include "ReplayBuffer.h"
 using namespace std;
 
 // stores the indices in the policy array
@@ -153,16 +158,40 @@ void move2index(const Position &p, Move m, Color color, PolicyIndex &policyIndex
 // initializes the random seed with the current time.
 void init_rand();
 
+// how the node array at the end of an MCTSNode's children buffer grows as leaves are promoted to nodes.
+// EXACT_NODE_ARRAYS reallocates for every promoted leaf, GEOMETRIC_NODE_ARRAYS doubles the capacity when it runs out,
+// and RESERVED_NODE_ARRAYS makes room for every child when the node is expanded.
+enum NodeArrayGrowth
+{
+	EXACT_NODE_ARRAYS,
+	GEOMETRIC_NODE_ARRAYS,
+	RESERVED_NODE_ARRAYS
+};
+const NodeArrayGrowth NODE_ARRAY_GROWTH = GEOMETRIC_NODE_ARRAYS;
+
+// how self-play games are written. TEXT_RECORDS is the old comma separated format, one line per field;
+// BINARY_RECORDS is the format described in GameRecord.h, and MOVES_ONLY_RECORDS is that format without the positions.
+enum RecordFormat
+{
+	TEXT_RECORDS,
+	BINARY_RECORDS,
+	MOVES_ONLY_RECORDS
+};
+
+class TablebaseCache; // see tablebase_evaluation.h
+
 /*
 The class that represents a node in the MCTS Tree
 */
 class MCTSNode
 {
 private:
-	// two bits store itp and color.
+	// bit 0 stores itp, bit 1 the color and bits 2-3 a proven value (see mark_proven).
 	uint8_t color_itp;
 	uint8_t num_children;
 	uint8_t num_expanded;
+	// number of in-flight selections passing through this node (see MCTS::select with multiple leaves)
+	uint8_t virtual_loss;
 	float q;
 	uint32_t num_times_selected;
 	uint8_t *children;
@@ -189,33 +218,52 @@ private:
 
 	inline MCTSNode &get_node_at(int node_num) { return begin_nodes()[node_num]; }
 
-	inline uint32_t size_of_children() { return sizeof(uint8_t) * 3 * ((uint32_t)num_children) + sizeof(MCTSNode) * num_expanded; }
+	// the number of nodes the children buffer has room for when expanded nodes are in use.
+	// the capacity is a function of num_expanded, so it does not need to be stored.
+	inline uint32_t node_capacity(uint32_t expanded)
+	{
+		if (NODE_ARRAY_GROWTH == RESERVED_NODE_ARRAYS)
+			return num_children;
+		if (NODE_ARRAY_GROWTH == EXACT_NODE_ARRAYS || expanded == 0)
+			return expanded;
+		uint32_t capacity = 1;
+		while (capacity < expanded)
+			capacity += capacity;
+		return std::min(capacity, (uint32_t)num_children);
+	}
+
+	inline uint32_t size_of_children(uint32_t expanded) { return sizeof(uint8_t) * 3 * ((uint32_t)num_children) + sizeof(MCTSNode) * node_capacity(expanded); }
+
+	inline uint32_t size_of_children() { return size_of_children(num_expanded); }
 
-	inline void reallocate_memory(MemoryManager &m)
+	// makes room for one more node. returns false, leaving children as it was, if the memory manager is out of memory.
+	inline bool reallocate_memory(MemoryManager &m)
 	{
-		uint32_t newsize = size_of_children();
-		uint32_t prevsize = newsize - sizeof(MCTSNode);
+		uint32_t prevsize = size_of_children();
+		uint32_t newsize = size_of_children(num_expanded + 1);
+		if (newsize == prevsize)
+			return true;
 		uint8_t *new_children = m.realloc_(children, prevsize, newsize);
 		if (!new_children)
-		{
-			std::cout << "error reallocing children. exiting...";
-			exit(1);
-		}
+			return false;
 		children = new_children;
+		return true;
 	}
 
-	inline void init_memory(MemoryManager &m)
+	// returns false, leaving the node a leaf, if the memory manager is out of memory.
+	inline bool init_memory(MemoryManager &m)
 	{
 		uint32_t s = size_of_children();
 		children = m.malloc_(s);
 		if (!children)
 		{
-			std::cout << "error allocating children. exiting...";
-			exit(1);
+			num_children = 0;
+			return false;
 		}
+		return true;
 	}
 
-	// adds a leaf to the nodes
+	// adds a leaf to the nodes. returns nullptr if the memory manager is out of memory.
 	MCTSNode *add_leaf(MemoryManager &m);
 
 public:
@@ -223,6 +271,9 @@ public:
 
 	inline size_t get_num_children() { return num_children; }
 
+	// the move to child i < get_num_children(). the children of an expanded node are all of its legal moves.
+	inline Move get_child_move(size_t i) { return get_move_at(i); }
+
 	// returns true if this node is a leaf. node may or may not be terminal as well.
 	inline bool is_leaf() { return num_children == 0; }
 
@@ -235,12 +286,37 @@ public:
 	// marks the current node as terminal position.
 	inline void mark_terminal_position() { color_itp = color_itp | 1; }
 
+	// returns true if the value of this node is known exactly: from the rules or the tablebase for a leaf, which is then
+	// terminal, or from its children for an inner node (see update_proven), which is not.
+	inline bool is_proven() { return color_itp & 12u; }
+
+	// the proven value, relative to this node's color. requires: is_proven().
+	inline int get_proven_value() { return (int)((color_itp >> 2) & 3u) - 2; }
+
+	// marks a leaf as a terminal position whose value, relative to this node's color, is value (-1, 0 or 1).
+	inline void mark_proven(int value) { color_itp = (color_itp & 3u) | ((value + 2) << 2) | 1; }
+
+	// makes a proven leaf a plain leaf again.
+	inline void clear_proven() { color_itp = color_itp & 2u; }
+
+	// proves an inner node from its children: it is a win if a child is a proven loss, and otherwise, once every child
+	// is expanded and proven, it is worth the best of their values. returns whether the node is proven.
+	bool update_proven();
+
 	// returns the number of times this node was selected.
 	inline uint32_t get_num_times_selected() { return num_times_selected; }
 
 	// returns the q value for this node. value is relative to this node's color (1 is good for current color, -1 is bad)
 	inline float get_mean_q() { return num_times_selected > 0 ? q / num_times_selected : 0.0f; }
 
+	// each pending selection counts as an extra visit that was a win for this node's color,
+	// which makes the parent less likely to pick this node again before update() is called.
+	inline void add_virtual_loss() { virtual_loss++; }
+
+	inline void revert_virtual_loss() { virtual_loss--; }
+
+	inline uint8_t get_virtual_loss() { return virtual_loss; }
+
 	inline MCTSNode *begin_nodes() { return (MCTSNode *)(children + ((long long)(num_children * 3))); }
 
 	inline MCTSNode *end_nodes() { return begin_nodes() + num_expanded; }
@@ -251,13 +327,6 @@ public:
 
 	inline uint8_t *end_leaves() { return children + ((long long)(num_children * 3)); }
 
-	// for use with MemoryBlock
-	inline void shift_children(int64_t diff)
-	{
-		if (children)
-			children += diff;
-	}
-
 	// the q value must be calculated given the color of the node.
 	void backup(float q);
 
@@ -272,6 +341,10 @@ public:
 		vector<pair<Move, float>> &leaves,
 		MemoryManager &m);
 
+	// expands the node from a cached evaluation. cached_children has the same layout as the leaves of a node.
+	// requires: the current node is a leaf. If it is terminal, no changes are made.
+	void expand(const uint8_t *cached_children, size_t size, MemoryManager &m);
+
 	// returns the number of nodes currently under this tree.
 	size_t size();
 
@@ -299,6 +372,10 @@ public:
 	// if it has no children then null is returned.
 	void select_best_child(const float cpuct, std::pair<MCTSNode *, Move> &child, MemoryManager &m);
 
+	// returns the most visited child that achieves this node's proven value, or nullptr if the node is not proven
+	// or has no such expanded child.
+	std::pair<MCTSNode *, Move> select_proven_child();
+
 	// returns the child to play based on visit count with the given temperature parameter.
 	// if there are no children that are not leaves, nullptr is returned.
 	// this can happen when the current node is a leaf (could be terminal position), or if
@@ -310,6 +387,7 @@ public:
 	MCTSNode(Color c) : color_itp(0),
 						num_children(0),
 						num_expanded(0),
+						virtual_loss(0),
 						q(0.0),
 						num_times_selected(0),
 						children(0)
@@ -329,23 +407,48 @@ class MCTS
 private:
 	static const uint32_t default_block_size;
 	static const uint32_t default_starting_size;
-	static const uint32_t max_possible_allocation_request;
+	static const int max_leaves_per_round;
+	static const int default_snapshot_stride;
 	MCTSNode *root;
 	MCTSNode *best_leaf;
-	Move *moves;
+	Move *moves; // MAX_MOVES entries per leaf that can be selected in one round
 	uint64_t nmoves;
 	vector<std::pair<MCTSNode *, Move>> best_leaf_path;
+	int leaves_per_round;
+	int num_leaf_paths;
+	// used when leaves_per_round > 1. each path stores (index into parent's nodes, move) from the root down to the leaf.
+	// indices are used instead of pointers since selecting a later path may reallocate the nodes of an earlier one.
+	vector<vector<pair<int, Move>>> leaf_paths;
+	vector<uint64_t> leaf_nmoves;
+	vector<MCTSNode *> path_nodes; // scratch space for replay_leaf_path
 	vector<pair<Move, float>> leaves;
 	Position p;
+	// see set_snapshot_stride. snapshots[k] is the position after the first k * snapshot_stride moves of snapshot_path,
+	// the moves of the last path that was followed. the first num_snapshots are valid; snapshots[0] is the root.
+	int snapshot_stride;
+	int next_snapshot_stride; // taken over by follow_path, when p can be brought back to the root
+	int num_snapshots;
+	vector<PositionSnapshot> snapshots;
+	vector<Move> snapshot_path;
 	bool auto_play;
 	uint64_t sim_limit;
 	const float default_temp;
 	string output_path_base;
 	ofstream output;
+	RecordFormat record_format;
+	string start_fen; // the first position of the current game if it is not the start position; written to its record
+	vector<pair<uint16_t, float>> record_policy; // scratch space for add_move
+	std::shared_ptr<GameWriter> game_writer;	 // optional; if set, games go to it instead of to output
+	ostringstream game_buffer;					 // the record of the current game when it goes to game_writer
+	bool buffered_game;							 // whether the current game is recorded into game_buffer
+	std::shared_ptr<ReplayBuffer> replay_buffer;	 // optional; if set, finished games are also added to it
+	vector<game_record::MoveRecord> replay_moves; // the moves of the current game when there is a replay buffer
 	int move_num;
 	int game_num;
 	int tablebase_eval; // >= 2 means no eval; -1, 0, 1 mean it's been set
 	std::shared_ptr<MemoryManager> memory_manager;
+	std::shared_ptr<TranspositionTable> transposition_table; // optional; nullptr disables it
+	std::shared_ptr<TablebaseCache> tablebase_cache;		 // optional; tablebase probes go through it if set
 
 	// adds a move to the current game
 	// we want to pass by value bc board_state, p, m, c, are made on stack.
@@ -357,38 +460,136 @@ private:
 	// adds a new game and resets all PIVs.
 	void new_game();
 
+	// generates the legal moves of p into buf and, if there are none, marks leaf as a terminal position
+	// proven lost (checkmate) or drawn (stalemate). proven nodes are left alone.
+	// requires: p is the position of leaf.
+	inline void detect_terminal(MCTSNode *leaf, Move *buf, uint64_t &n)
+	{
+		if (leaf->is_terminal_position() || leaf->is_proven())
+			return;
+		if (leaf->get_color() == WHITE)
+			n = p.generate_legals<WHITE>(buf) - buf;
+		else
+			n = p.generate_legals<BLACK>(buf) - buf;
+		if (n == 0)
+			leaf->mark_proven((leaf->get_color() == WHITE ? p.in_check<WHITE>() : p.in_check<BLACK>()) ? -1 : 0);
+	}
+
+	// the same, for when the moves are not needed: stops at the first legal move instead of generating them all.
+	inline void detect_terminal(MCTSNode *leaf)
+	{
+		if (leaf->is_terminal_position() || leaf->is_proven())
+			return;
+		if (!(leaf->get_color() == WHITE ? p.has_legal_move<WHITE>() : p.has_legal_move<BLACK>()))
+			leaf->mark_proven((leaf->get_color() == WHITE ? p.in_check<WHITE>() : p.in_check<BLACK>()) ? -1 : 0);
+	}
+
+	// whether the root is proven and auto play should play it without waiting for the sim limit.
+	inline bool play_proven_root() { return auto_play && root->is_proven(); }
+
+	// moves p from the root to the end of path, whose moves start at path[first]. with snapshots, p resumes from the
+	// deepest snapshot of the part it shares with the last path and may be anywhere before; otherwise it must be at the root.
+	template <typename Path>
+	void follow_path(const Path &path, size_t first);
+
+	// moves p from the end of path, whose moves start at path[first], back to the root.
+	template <typename Path>
+	void return_to_root(const Path &path, size_t first);
+
+	// forgets the snapshots. must be called whenever the root position changes.
+	inline void invalidate_snapshots()
+	{
+		num_snapshots = 0;
+		snapshot_path.clear();
+	}
+
+	// selects a leaf starting from the root, applying a virtual loss to every node on the way and recording the path
+	// in leaf_paths[i]. p is not moved. returns the selected leaf.
+	MCTSNode *select_leaf_path(const float cpuct, int i);
+
+	// walks leaf_paths[i] from the root, playing each move and collecting the visited nodes into path_nodes.
+	void replay_leaf_path(int i);
+
+	// removes the virtual loss that select_leaf_path applied along leaf_paths[i]. does not touch p.
+	void revert_leaf_path(int i);
+
+	// collects the nodes of leaf_paths[i] into path_nodes without touching p.
+	void collect_leaf_path_nodes(int i);
+
+	// if p is in the transposition table, expands leaf from it and writes the cached q (relative to leaf's color) to q.
+	// returns whether that happened. requires: p is the position of leaf.
+	bool expand_from_table(MCTSNode *leaf, float &q);
+
+	// if leaf is proven, or is a new leaf (other than the root) that the tablebase knows, writes its exact value
+	// (relative to leaf's color) to q and returns true; the network does not need to see it.
+	// requires: p is the position of leaf.
+	bool probe_leaf(MCTSNode *leaf, float &q);
+
+	// the value of a terminal leaf relative to its color. requires: p is the position of leaf.
+	float terminal_value(MCTSNode *leaf);
+
+	// stores the network evaluation of a freshly expanded leaf in the transposition table.
+	// requires: p is the position of leaf.
+	void store_in_table(MCTSNode *leaf, float q);
+
+	// proves the nodes of path_nodes that their children prove, from the leaf up, stopping at the first that is not.
+	void propagate_proven();
+
+	// backs val (relative to best_leaf_color) up along best_leaf_path and undoes its moves, leaving p at the root.
+	// the path is proven from the leaf up first, like propagate_proven.
+	void backup_best_leaf_path(float val, Color best_leaf_color);
+
+	// moves p back to the root. requires: p is at the end of leaf_paths[i].
+	void unwind_leaf_path(int i);
+
 	// the select helper. returns true if select-helper led to selecting on a terminal position and nothing was written.
 	// false otherwise (even if autoplay off and max sim_limit reached)
 	// white_moves and black_moves will be set to nullptr if this function returns false.
 	// requires: max sim_limit not reached.
 	bool select_helper(const float cpuct, Ndarray<int, 2> &board, Ndarray<int, 1> &metadata);
 
+	// where the current game is recorded, or nullptr if it is not.
+	inline ostream *record_stream()
+	{
+		if (buffered_game)
+			return &game_buffer;
+		if (output.is_open())
+			return &output;
+		return nullptr;
+	}
+
 	inline void update_output()
 	{
 		if (this->output.is_open())
 			this->output.close();
-		if (!output_path_base.empty())
+		game_buffer.str("");
+		buffered_game = game_writer != nullptr;
+		if (!buffered_game && !output_path_base.empty())
+		{
+			if (record_format != TEXT_RECORDS)
+				this->output.open(output_path_base + "_" + to_string(game_num), ios::out | ios::binary);
+			else
+				this->output.open(output_path_base + "_" + to_string(game_num));
+		}
+		ostream *out = record_stream();
+		if (out != nullptr && record_format != TEXT_RECORDS)
 		{
-			this->output.open(output_path_base + "_" + to_string(game_num));
+			game_record::write_header(*out);
+			if (!start_fen.empty())
+				game_record::write_start_position(*out, start_fen);
 		}
 	}
 
 	inline void delete_root()
 	{
-		if (root != nullptr)
+		// if the memory manager releases in bulk, reset() below takes back the children of every node.
+		if (root != nullptr && memory_manager->releases_in_bulk())
+			delete root;
+		else if (root != nullptr)
 			MCTSNode::recursive_delete(*root, nullptr, true, *memory_manager);
 		memory_manager->reset();
 	}
 
-	// requires: node has already been shifted (is a valid pointer)
-	inline void shift_tree(MCTSNode *node, int64_t diff)
-	{
-		if (!node)
-			return;
-		node->shift_children(diff);
-		for (int i = 0; i < node->get_num_expanded(); i++)
-			shift_tree(node->begin_nodes() + i, diff);
-	}
 
 public:
 	// the temperature to use for calculating the policy and selecting the best child by count.
@@ -399,6 +600,7 @@ public:
 	inline void set_position(const Position &pos)
 	{
 		this->p = pos;
+		invalidate_snapshots();
 		delete_root();
 		if (pos.turn() == WHITE)
 			root = new MCTSNode(WHITE);
@@ -406,10 +608,17 @@ public:
 			root = new MCTSNode(BLACK);
 		best_leaf = nullptr;
 		best_leaf_path.clear();
+		num_leaf_paths = 0;
 		temperature = default_temp;
 		nmoves = 0;
 		move_num = 1;
 		game_num = 1;
+		// the game starts over, so its record does too, from pos.
+		start_fen = pos.fen();
+		if (start_fen == Position().fen())
+			start_fen.clear();
+		replay_moves.clear();
+		update_output();
 	}
 
 	// returns whether the game is over (root is terminal or tablebase result)
@@ -427,6 +636,33 @@ public:
 			return 0.0f;
 	}
 
+	// sets the table used to look up evaluations of positions that were already evaluated by the network.
+	// pass nullptr to disable it.
+	inline void set_transposition_table(std::shared_ptr<TranspositionTable> tt) { transposition_table = tt; }
+
+	inline std::shared_ptr<TranspositionTable> get_transposition_table() { return transposition_table; }
+
+	// sets the cache that tablebase probes go through. pass nullptr to probe the tablebase directly.
+	inline void set_tablebase_cache(std::shared_ptr<TablebaseCache> cache) { tablebase_cache = cache; }
+
+	// caps the memory of the tree. once it is reached the tree stops growing: leaves are no longer expanded
+	// and selection keeps to nodes that already exist, until the next move frees the discarded subtrees.
+	inline void set_memory_limit(uint64_t bytes) { memory_manager->set_limit(bytes); }
+
+	// the number of bytes the memory manager has taken for the tree.
+	inline uint64_t memory_usage() { return memory_manager->size(); }
+
+	// with stride > 0, the position is saved every stride moves along the last path that was followed. the next path
+	// resumes from the deepest snapshot it shares with it instead of playing every move from the root, and going back to
+	// the root restores a snapshot instead of undoing every move. 0 plays and undoes every move.
+	// takes effect from the next path that is followed, so it can be called between select() and update().
+	inline void set_snapshot_stride(int stride) { next_snapshot_stride = std::max(stride, 0); }
+
+	inline int get_snapshot_stride() { return next_snapshot_stride; }
+
+	// the maximum number of leaves that select() hands out per round.
+	inline int get_leaves_per_round() { return leaves_per_round; }
+
 	// returns whether we have reached the sim limit. relevent only if auto_play is false.
 	inline bool reached_sim_limit() { return root->get_num_times_selected() >= sim_limit; }
 
@@ -449,9 +685,13 @@ public:
 	// 1 means we are winning, 0 means game is even, -1 means we are losing.
 	inline float minimax_evaluation() { return root->minimax_evaluation(); }
 
-	// selects the best move by count with the given temperature
+	// selects the best move by count with the given temperature, or the move that achieves the root's proven value.
 	// REQUIRES: root is not terminal and has been expanded at least once!
-	inline Move get_best_move(float temperature) { return root->select_best_child_by_count(temperature).second; }
+	inline Move get_best_move(float temperature)
+	{
+		std::pair<MCTSNode *, Move> proven = root->select_proven_child();
+		return proven.first ? proven.second : root->select_best_child_by_count(temperature).second;
+	}
 
 	// same as play_best_move() except the game tree is reset
 	inline void play_best_move_and_reset()
@@ -473,7 +713,8 @@ public:
 	// requires that you re-select afterwards...
 	void undo_select();
 
-	// samples a move from the policy according to the temperature and plays it.
+	// samples a move from the policy according to the temperature and plays it. if the root is proven, the move
+	// that achieves its value is played instead, and with auto play that happens as soon as the root is proven.
 	// if we are at a terminal position, we do nothing
 	// if the best move leads to a terminal position and autoplay is on, the game is restarted
 	// cannot be called between select() and update()
@@ -488,6 +729,30 @@ public:
 	// the game number we are on. starts at 1.
 	int game_number();
 
+	// sends finished games to writer instead of writing one file per game. nullptr goes back to the files.
+	// takes effect immediately if the current game has no moves yet, and from the next game otherwise.
+	inline void set_game_writer(std::shared_ptr<GameWriter> writer)
+	{
+		game_writer = writer;
+		if (move_num == 1)
+			update_output();
+	}
+
+	// adds every game finished from now on to buffer. nullptr stops it.
+	inline void set_replay_buffer(std::shared_ptr<ReplayBuffer> buffer)
+	{
+		replay_buffer = buffer;
+		replay_moves.clear();
+	}
+
+	// sets how games are written; TEXT_RECORDS by default. takes effect immediately if the current game has no moves yet, and from the next game otherwise.
+	inline void set_record_format(RecordFormat format)
+	{
+		record_format = format;
+		if (move_num == 1)
+			update_output();
+	}
+
 	// selects the best leaf thru MCTS and writes the position and the legal moves. Not threadsafe.
 	// Additionally, sets the best_leaf* to point to the selected node.
 	// It is possible to select a terminal node. If this happens, the next call to update() will not use the provided policy.
@@ -500,16 +765,40 @@ public:
 	// requires: select has been called. policy is softmaxed
 	void update(const float q, Ndarray<float, 3> policy);
 
+	// selects up to leaves_per_round distinct leaves using virtual loss and writes them to boards[offset ... offset + leaves_per_round).
+	// slots that could not be filled (collisions, or fewer sims left before the sim limit) get the root position,
+	// and their evaluation is ignored by update(). p is left at the root. Not threadsafe.
+	// returns the number of leaves selected.
+	int select(const float cpuct, Ndarray<int, 3> boards, Ndarray<int, 2> metadata, int offset);
+
+	// the counterpart of the select() above. q[offset + i] and policy[offset + i] are the evaluation of the ith selected leaf.
+	void update(Ndarray<float, 1> q, Ndarray<float, 4> policy, int offset);
+
 	// auto-auto_play: whether to automatically play the next move when num_sims_to_play is reached
 	MCTS(const int num_sims_per_move,
 		 std::shared_ptr<MemoryManager> mm,
 		 float t = 1.0,
 		 bool auto_play = true,
-		 string output = "") : root(new MCTSNode(WHITE)), best_leaf(nullptr), best_leaf_path(), p(),
-							   sim_limit(num_sims_per_move), temperature(t), default_temp(t),
-							   auto_play(auto_play), moves(new Move[MAX_MOVES]), nmoves(0), leaves(MAX_MOVES, pair<Move, float>(0, 0.0f)),
-							   move_num(1), game_num(1), output_path_base(output), tablebase_eval(2), memory_manager(mm)
+		 string output = "",
+		 int leaves_per_round = 1) : root(new MCTSNode(WHITE)), best_leaf(nullptr), moves(nullptr), nmoves(0), best_leaf_path(),
+									 leaves_per_round(leaves_per_round), num_leaf_paths(0), leaves(MAX_MOVES, pair<Move, float>(0, 0.0f)), p(),
+									 snapshot_stride(default_snapshot_stride), next_snapshot_stride(default_snapshot_stride),
+									 num_snapshots(0),
+									 auto_play(auto_play), sim_limit(num_sims_per_move), default_temp(t),
+									 output_path_base(output), record_format(TEXT_RECORDS), buffered_game(false),
+									 move_num(1), game_num(1), tablebase_eval(2), memory_manager(mm), temperature(t)
 	{
+		if (leaves_per_round < 1 || leaves_per_round > max_leaves_per_round)
+			throw std::runtime_error("leaves_per_round must be between 1 and " + to_string(max_leaves_per_round));
+		moves = new Move[MAX_MOVES * leaves_per_round];
+		if (leaves_per_round > 1)
+		{
+			leaf_paths.resize(leaves_per_round);
+			leaf_nmoves.resize(leaves_per_round, 0);
+			for (auto &path : leaf_paths)
+				path.reserve(200);
+			path_nodes.reserve(200);
+		}
 		update_output();
 		best_leaf_path.reserve(200);
 	}
@@ -517,13 +806,14 @@ public:
 	MCTS(const int num_sims_per_move,
 		 float t = 1.0,
 		 bool auto_play = true,
-		 string output = "") : MCTS(num_sims_per_move,
-									std::make_shared<DefaultMemoryManager>(), t,
-									auto_play, output) {}
+		 string output = "",
+		 int leaves_per_round = 1) : MCTS(num_sims_per_move,
+										  std::make_shared<DefaultMemoryManager>(), t,
+										  auto_play, output, leaves_per_round) {}
 	~MCTS()
 	{
 		if (root != nullptr)
-			MCTSNode::recursive_delete(*root, nullptr, true, *memory_manager);
+			delete_root();
 		if (moves != nullptr)
 			delete[] moves;
 		output.close();
@@ -539,18 +829,38 @@ public:
 			   moves(other.moves),
 			   nmoves(other.nmoves),
 			   best_leaf_path(std::move(other.best_leaf_path)),
+			   leaves_per_round(other.leaves_per_round),
+			   num_leaf_paths(other.num_leaf_paths),
+			   leaf_paths(std::move(other.leaf_paths)),
+			   leaf_nmoves(std::move(other.leaf_nmoves)),
+			   path_nodes(std::move(other.path_nodes)),
 			   leaves(std::move(other.leaves)),
 			   p(std::move(other.p)),
+			   snapshot_stride(other.snapshot_stride),
+			   next_snapshot_stride(other.next_snapshot_stride),
+			   num_snapshots(other.num_snapshots),
+			   snapshots(std::move(other.snapshots)),
+			   snapshot_path(std::move(other.snapshot_path)),
 			   auto_play(other.auto_play),
 			   sim_limit(other.sim_limit),
 			   default_temp(other.default_temp),
 			   output_path_base(other.output_path_base),
 			   output(std::move(other.output)),
+			   record_format(other.record_format),
+			   start_fen(std::move(other.start_fen)),
+			   record_policy(std::move(other.record_policy)),
+			   game_writer(std::move(other.game_writer)),
+			   game_buffer(std::move(other.game_buffer)),
+			   buffered_game(other.buffered_game),
+			   replay_buffer(std::move(other.replay_buffer)),
+			   replay_moves(std::move(other.replay_moves)),
 			   move_num(other.move_num),
 			   game_num(other.game_num),
-			   temperature(other.temperature),
 			   tablebase_eval(other.tablebase_eval),
-			   memory_manager(std::move(other.memory_manager))
+			   memory_manager(std::move(other.memory_manager)),
+			   transposition_table(std::move(other.transposition_table)),
+			   tablebase_cache(std::move(other.tablebase_cache)),
+			   temperature(other.temperature)
 	{
 		other.root = nullptr;
 		other.moves = nullptr;
@@ -0,0 +1,63 @@
+#include "ReplayBuffer.h"
+#include <cmath>
+
+void ReplayBuffer::add_game(const std::vector<game_record::MoveRecord> &moves, int result)
+{
+	std::lock_guard<std::mutex> lock(m);
+	for (const game_record::MoveRecord &rec : moves)
+	{
+		// drop the oldest positions until there is a slot and room for the policy entries.
+		while (last - first >= capacity_ || (first < last && entries_end + rec.policy.size() - entries_begin() > entry_capacity))
+			first++;
+
+		Slot &slot = slots[last % capacity_];
+		for (int j = 0; j < ROWS * COLS; j++)
+			slot.board[j] = (int8_t)rec.board[j / COLS][j % COLS];
+		for (int j = 0; j < METADATA_LENGTH; j++)
+			slot.metadata[j] = (int8_t)rec.metadata[j];
+		slot.value = (int8_t)(rec.color == WHITE ? result : -result);
+		slot.num_legal = (uint16_t)rec.policy.size();
+		slot.policy_begin = entries_end;
+		for (const auto &entry : rec.policy)
+			entries[entries_end++ % entry_capacity] = entry;
+		last++;
+	}
+	games++;
+}
+
+int ReplayBuffer::sample(int batch_size, double half_life, int *boards, int *metadata, float *policy, int *legal_moves, float *values)
+{
+	// copy the sampled positions out under the lock, then expand them without it.
+	std::vector<Slot> sampled(batch_size);
+	std::vector<std::pair<uint16_t, float>> sampled_entries;
+	sampled_entries.reserve((size_t)batch_size * default_entries_per_position);
+	{
+		std::lock_guard<std::mutex> lock(m);
+		uint64_t n = last - first;
+		if (n == 0)
+			return 0;
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		// with recency weighting, the age of a sample follows an exponential distribution truncated to [0, n).
+		double rate = half_life > 0 ? std::log(2.0) / half_life : 0.0;
+		double tail = rate > 0 ? 1.0 - std::exp(-rate * n) : 0.0;
+		for (int b = 0; b < batch_size; b++)
+		{
+			uint64_t age;
+			if (rate > 0)
+				age = std::min<uint64_t>((uint64_t)(-std::log(1.0 - uniform(rng) * tail) / rate), n - 1);
+			else
+				age = std::min<uint64_t>((uint64_t)(uniform(rng) * n), n - 1);
+			const Slot &slot = slots[(last - 1 - age) % capacity_];
+			sampled[b] = slot;
+			sampled[b].policy_begin = sampled_entries.size();
+			for (uint64_t e = slot.policy_begin; e < slot.policy_begin + slot.num_legal; e++)
+				sampled_entries.push_back(entries[e % entry_capacity]);
+		}
+	}
+
+	pool.parallel_for(0, batch_size, DataLoader::fill_chunk_size, [&](int begin, int end)
+					  {
+		for (int b = begin; b < end; b++)
+			DataLoader::fill_example(sampled[b], sampled_entries.data(), b, boards, metadata, policy, legal_moves, values); });
+	return batch_size;
+}
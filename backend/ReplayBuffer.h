@@ -0,0 +1,87 @@
+#pragma once
+#include <vector>
+#include <mutex>
+#include <random>
+#include <stdint.h>
+#include "Constants.h"
+#include "GameRecord.h"
+#include "DataLoader.h"
+#include "ThreadPool.h"
+
+/*
+A window of the most recent self-play positions, kept in memory so that training can sample them while games are
+still being played. Trees add whole games when they end; the oldest positions are dropped once the buffer holds
+capacity positions, or once their policy entries no longer fit.
+Positions are stored like DataLoader examples: in a ring of fixed size slots, with the sparse policies in a second
+ring of capacity * entries_per_position entries. Both rings are filled and emptied in the same order.
+All methods are threadsafe.
+*/
+class ReplayBuffer
+{
+private:
+	typedef DataLoader::Example Slot;
+
+	size_t const capacity_;
+	size_t const entry_capacity;
+	std::vector<Slot> slots;							// slot i holds the position added i-th, modulo capacity_
+	std::vector<std::pair<uint16_t, float>> entries; // entry i holds the i-th policy entry added, modulo entry_capacity
+	uint64_t first = 0;								// the number of positions ever added that are no longer held
+	uint64_t last = 0;								// the number of positions ever added
+	uint64_t entries_end = 0;						// the number of policy entries ever added
+	uint64_t games = 0;								// the number of games ever added
+
+	std::mutex m;
+	std::mt19937_64 rng;
+	ThreadPool pool;
+
+	// the logical index of the first policy entry still held. requires: m is held.
+	inline uint64_t entries_begin() { return first < last ? slots[first % capacity_].policy_begin : entries_end; }
+
+public:
+	static const size_t default_entries_per_position = 64;
+
+	ReplayBuffer(size_t capacity,
+				 int num_threads = 1,
+				 uint64_t seed = std::random_device()(),
+				 size_t entries_per_position = default_entries_per_position) : capacity_(std::max<size_t>(capacity, 1)),
+																			   entry_capacity(std::max<size_t>(capacity * entries_per_position, MAX_MOVES)),
+																			   slots(capacity_),
+																			   entries(entry_capacity),
+																			   rng(seed),
+																			   pool(num_threads) {}
+
+	ReplayBuffer(const ReplayBuffer &other) = delete;
+	ReplayBuffer &operator=(const ReplayBuffer &other) = delete;
+
+	// adds the positions of a finished game. result is 1 if white won, -1 if black won and 0 for a draw.
+	void add_game(const std::vector<game_record::MoveRecord> &moves, int result);
+
+	/*
+	samples batch_size positions with replacement into the buffers of DataLoader::next_batch.
+	with half_life 0 every position is equally likely; otherwise a position's weight halves with every half_life
+	positions added after it. returns the number of positions written: batch_size, or 0 if the buffer is empty.
+	*/
+	int sample(int batch_size, double half_life, int *boards, int *metadata, float *policy, int *legal_moves, float *values);
+
+	inline size_t capacity() { return capacity_; }
+
+	// the number of positions held
+	inline size_t size()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return last - first;
+	}
+
+	// the number of positions ever added
+	inline uint64_t positions_added()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return last;
+	}
+
+	inline uint64_t games_added()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		return games;
+	}
+};
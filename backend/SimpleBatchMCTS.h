@@ -8,6 +8,7 @@
 #include <iostream>
 #include <time.h>
 #include "MCTS.h"
+#include "ThreadPool.h"
 
 class SimpleBatchMCTS
 {
@@ -20,6 +21,7 @@ private:
     Ndarray<int, 2> metadata; // (batch_size * num_sectors, 5)
 
     std::vector<MCTS> arr;
+    ThreadPool pool;
 
     inline void process_thread(Ndarray<float, 1> q, Ndarray<float, 4> policy, int start, int end)
     {
@@ -39,19 +41,13 @@ public:
     // (batch_size), (batch_size, rows, cols, moves_per_square)
     inline void update(Ndarray<float, 1> q, Ndarray<float, 4> policy)
     {
-        std::vector<std::thread> threads;
-        for (int i = 0; i < num_threads; i++)
-        {
+        pool.run([&](int i)
+                 {
             int start = (int)((1.0 * i / num_threads) * batch_size);
             int end = (int)(1.0 * (i + 1) / num_threads * batch_size);
             if (i == num_threads - 1)
                 end = batch_size;
-            std::thread thd(&SimpleBatchMCTS::process_thread, this, q, policy, start, end);
-            threads.push_back(std::move(thd));
-        }
-
-        for (std::thread &t : threads)
-            t.join();
+            process_thread(q, policy, start, end); });
     }
 
     // sets the temperature for each game
@@ -128,11 +124,13 @@ public:
         int batch_size,
         float cpuct,
         Ndarray<int, 3> boards,
-        Ndarray<int, 2> metadata) : num_threads(num_threads),
+        Ndarray<int, 2> metadata,
+        bool pin_threads = false) : num_threads(num_threads),
                                     batch_size(batch_size),
                                     cpuct(cpuct),
                                     boards(boards),
-                                    metadata(metadata)
+                                    metadata(metadata),
+                                    pool(num_threads, pin_threads)
     {
         if (boards.getShape(0) != batch_size || boards.getShape(1) != ROWS || boards.getShape(2) != COLS)
             throw std::runtime_error("boards must have shape (batch_size * num_sectors, 8, 8)");
@@ -0,0 +1,168 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <algorithm>
+#include <condition_variable>
+#include <stdint.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+A fixed set of worker threads that live as long as the pool.
+run(task) calls task(worker_id) once on every worker and returns when all of them are done,
+so it replaces spawning and joining num_threads std::threads for every batch.
+parallel_for splits a range into chunks and balances them between the workers by work stealing.
+run and parallel_for are not reentrant: only one thread at a time may call them.
+*/
+class ThreadPool
+{
+private:
+	std::vector<std::thread> workers;
+	std::function<void(int)> task;
+	std::mutex m;
+	std::condition_variable start;	 // notified when a new task is posted or the pool is dying
+	std::condition_variable done;	 // notified when the last worker finishes a task
+	uint64_t generation = 0;		 // incremented for every task
+	int remaining = 0;				 // workers still running the current task
+	bool alive = true;
+
+	// the chunks of a parallel_for owned by one worker. the owner takes from the front, thieves from the back.
+	struct WorkQueue
+	{
+		std::mutex m;
+		std::deque<std::pair<int, int>> chunks;
+	};
+	std::unique_ptr<WorkQueue[]> queues;
+
+	inline bool pop_front(int id, std::pair<int, int> &chunk)
+	{
+		std::lock_guard<std::mutex> lock(queues[id].m);
+		if (queues[id].chunks.empty())
+			return false;
+		chunk = queues[id].chunks.front();
+		queues[id].chunks.pop_front();
+		return true;
+	}
+
+	inline bool pop_back(int id, std::pair<int, int> &chunk)
+	{
+		std::lock_guard<std::mutex> lock(queues[id].m);
+		if (queues[id].chunks.empty())
+			return false;
+		chunk = queues[id].chunks.back();
+		queues[id].chunks.pop_back();
+		return true;
+	}
+
+	void worker_loop(int id)
+	{
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(m);
+		while (true)
+		{
+			start.wait(lock, [&]
+					   { return generation != seen || !alive; });
+			if (!alive)
+				return;
+			seen = generation;
+			lock.unlock();
+			task(id);
+			lock.lock();
+			if (--remaining == 0)
+				done.notify_all();
+		}
+	}
+
+	// pins the worker to a single cpu. best effort: failures are ignored.
+	void pin(int id)
+	{
+#ifdef __linux__
+		unsigned int num_cpus = std::thread::hardware_concurrency();
+		if (num_cpus == 0)
+			return;
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(id % num_cpus, &cpus);
+		pthread_setaffinity_np(workers[id].native_handle(), sizeof(cpu_set_t), &cpus);
+#endif
+	}
+
+public:
+	ThreadPool(int num_threads, bool pin_threads = false)
+	{
+		if (num_threads < 1)
+			throw std::runtime_error("a thread pool needs at least one thread");
+		queues.reset(new WorkQueue[num_threads]);
+		workers.reserve(num_threads);
+		for (int i = 0; i < num_threads; i++)
+		{
+			workers.emplace_back(&ThreadPool::worker_loop, this, i);
+			if (pin_threads)
+				pin(i);
+		}
+	}
+
+	ThreadPool(const ThreadPool &other) = delete;
+	ThreadPool &operator=(const ThreadPool &other) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			alive = false;
+		}
+		start.notify_all();
+		for (std::thread &t : workers)
+			t.join();
+	}
+
+	// calls f(worker_id) on every worker, for worker_id in [0, size()), and waits for all of them.
+	void run(const std::function<void(int)> &f)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		task = f;
+		remaining = (int)workers.size();
+		generation++;
+		start.notify_all();
+		done.wait(lock, [&]
+				  { return remaining == 0; });
+	}
+
+	/*
+	calls f(chunk_begin, chunk_end) for consecutive chunks of at most chunk_size that cover [begin, end), and waits for all of them.
+	every worker starts with a contiguous run of chunks, like a static split, and a worker that runs out
+	steals chunks from the ends of the other workers' runs. so a few slow chunks do not hold up the whole range.
+	*/
+	void parallel_for(int begin, int end, int chunk_size, const std::function<void(int, int)> &f)
+	{
+		int n = (int)workers.size();
+		chunk_size = std::max(chunk_size, 1);
+		int num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+		for (int w = 0; w < n; w++)
+		{
+			queues[w].chunks.clear();
+			for (int c = (int)((long)num_chunks * w / n); c < (int)((long)num_chunks * (w + 1) / n); c++)
+				queues[w].chunks.emplace_back(begin + c * chunk_size, std::min(end, begin + (c + 1) * chunk_size));
+		}
+		run([&](int id)
+			{
+			std::pair<int, int> chunk;
+			while (pop_front(id, chunk))
+				f(chunk.first, chunk.second);
+			// chunks are never added during a run, so one pass over the other workers finds all that is left.
+			for (int k = 1; k < n; k++)
+			{
+				int victim = (id + k) % n;
+				while (pop_back(victim, chunk))
+					f(chunk.first, chunk.second);
+			} });
+	}
+
+	inline int size() { return (int)workers.size(); }
+};
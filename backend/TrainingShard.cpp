@@ -0,0 +1,213 @@
+#include "TrainingShard.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace training_shard;
+
+// maps the whole file read only, like map_file in tbprobe.cpp. returns nullptr if it cannot be mapped.
+// without mmap, the file is read into a buffer instead.
+static void *map_file(const std::string &path, size_t &size)
+{
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+	struct stat statbuf;
+	if (fstat(fd, &statbuf) || statbuf.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+	size = statbuf.st_size;
+	void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		perror("mmap");
+		return nullptr;
+	}
+	return data;
+#else
+	std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!in || in.tellg() <= 0)
+		return nullptr;
+	size = (size_t)in.tellg();
+	char *data = new char[size];
+	if (!in.seekg(0) || !in.read(data, size))
+	{
+		delete[] data;
+		return nullptr;
+	}
+	return data;
+#endif
+}
+
+static void unmap_file(void *data, size_t size)
+{
+#ifndef _WIN32
+	if (data && munmap(data, size) != 0)
+		perror("munmap");
+#else
+	delete[] (char *)data;
+#endif
+}
+
+// whether the mapped file holds a complete header of this build, followed by exactly count records of stride bytes.
+static bool valid(const void *map, size_t bytes, const char magic[4], uint16_t stride)
+{
+	if (map == nullptr || bytes < sizeof(Header))
+		return false;
+	const Header &h = *(const Header *)map;
+	return memcmp(h.magic, magic, 4) == 0 && h.version == VERSION &&
+		   h.rows == ROWS && h.cols == COLS && h.moves_per_square == MOVES_PER_SQUARE && h.metadata_length == METADATA_LENGTH &&
+		   h.stride == stride && h.count == (bytes - sizeof(Header)) / stride && (bytes - sizeof(Header)) % stride == 0;
+}
+
+ShardWriter::ShardWriter(const std::string &base) : index(base + ".index", std::ios::out | std::ios::binary | std::ios::trunc),
+													data(base + ".data", std::ios::out | std::ios::binary | std::ios::trunc)
+{
+	write_header(index, INDEX_MAGIC, sizeof(Record), 0);
+	write_header(data, DATA_MAGIC, sizeof(Entry), 0);
+}
+
+void ShardWriter::write_header(std::ofstream &os, const char magic[4], uint16_t stride, uint64_t count)
+{
+	Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, magic, 4);
+	h.version = VERSION;
+	h.rows = ROWS;
+	h.cols = COLS;
+	h.moves_per_square = MOVES_PER_SQUARE;
+	h.metadata_length = METADATA_LENGTH;
+	h.stride = stride;
+	h.count = count;
+	os.write((const char *)&h, sizeof(h));
+}
+
+void ShardWriter::add(const int8_t *board, const int8_t *metadata, int value, const std::pair<uint16_t, float> *policy, int n)
+{
+	n = std::min(n, MAX_MOVES);
+	Record r;
+	memset(&r, 0, sizeof(r));
+	for (int s = 0; s < ROWS * COLS; s++)
+		r.board[s / 2] |= (board[s] & 0xf) << (4 * (s % 2));
+	for (int i = 0; i < 4; i++)
+		r.castling |= (metadata[i] != 0) << i;
+	r.en_passant = (int8_t)metadata[4];
+	r.value = (int8_t)value;
+	r.num_legal = (uint16_t)n;
+	r.policy_begin = num_entries;
+	index.write((const char *)&r, sizeof(r));
+
+	Entry buf[MAX_MOVES];
+	for (int i = 0; i < n; i++)
+	{
+		buf[i].index = policy[i].first;
+		buf[i].prob = (uint16_t)std::lround(std::min(std::max(policy[i].second, 0.0f), 1.0f) * 65535.0f);
+	}
+	data.write((const char *)buf, n * sizeof(Entry));
+	num_entries += n;
+	num_records++;
+}
+
+void ShardWriter::add_game(const std::vector<game_record::MoveRecord> &moves, int result)
+{
+	int8_t board[ROWS * COLS], metadata[METADATA_LENGTH];
+	for (const game_record::MoveRecord &rec : moves)
+	{
+		for (int j = 0; j < ROWS * COLS; j++)
+			board[j] = (int8_t)rec.board[j / COLS][j % COLS];
+		for (int j = 0; j < METADATA_LENGTH; j++)
+			metadata[j] = (int8_t)rec.metadata[j];
+		add(board, metadata, rec.color == WHITE ? result : -result, rec.policy.data(), (int)rec.policy.size());
+	}
+}
+
+void ShardWriter::add(const DataLoader::Example &ex, const std::pair<uint16_t, float> *entries)
+{
+	add(ex.board, ex.metadata, ex.value, entries + ex.policy_begin, ex.num_legal);
+}
+
+bool ShardWriter::close()
+{
+	if (closed)
+		return true;
+	closed = true;
+	index.seekp(0);
+	write_header(index, INDEX_MAGIC, sizeof(Record), num_records);
+	data.seekp(0);
+	write_header(data, DATA_MAGIC, sizeof(Entry), num_entries);
+	bool good = ok();
+	index.close();
+	data.close();
+	return good;
+}
+
+ShardReader::ShardReader(const std::string &base)
+{
+	index_map = map_file(base + ".index", index_bytes);
+	data_map = map_file(base + ".data", data_bytes);
+	if (!valid(index_map, index_bytes, INDEX_MAGIC, sizeof(Record)) || !valid(data_map, data_bytes, DATA_MAGIC, sizeof(Entry)))
+		return;
+	num_records = ((const Header *)index_map)->count;
+	num_entries = ((const Header *)data_map)->count;
+	records = (const Record *)((const char *)index_map + sizeof(Header));
+	entries = (const Entry *)((const char *)data_map + sizeof(Header));
+}
+
+ShardReader::~ShardReader()
+{
+	unmap_file(index_map, index_bytes);
+	unmap_file(data_map, data_bytes);
+}
+
+bool ShardReader::fill(uint64_t i, int b, int *boards, int *metadata, float *policy, int *legal_moves, float *values)
+{
+	if (i >= num_records)
+		return false;
+	const Record &r = records[i];
+	if (r.policy_begin > num_entries || r.num_legal > num_entries - r.policy_begin)
+		return false;
+
+	const size_t policy_size = ROWS * COLS * MOVES_PER_SQUARE;
+	for (int s = 0; s < ROWS * COLS; s++)
+		boards[b * ROWS * COLS + s] = r.piece(s);
+	for (int j = 0; j < METADATA_LENGTH; j++)
+		metadata[b * METADATA_LENGTH + j] = r.metadata(j);
+	float *pol = policy + b * policy_size;
+	int *legal = legal_moves + b * policy_size;
+	memset(pol, 0, policy_size * sizeof(float));
+	memset(legal, 0, policy_size * sizeof(int));
+	const Entry *e = entries + r.policy_begin;
+	// 16 bit probabilities do not add up to exactly 1.
+	float tot = 0;
+	for (int k = 0; k < r.num_legal; k++)
+		tot += e[k].prob;
+	for (int k = 0; k < r.num_legal; k++)
+	{
+		if (e[k].index >= policy_size)
+			continue;
+		pol[e[k].index] = tot > 0 ? e[k].prob / tot : 0.0f;
+		legal[e[k].index] = 1;
+	}
+	values[b] = r.value;
+	return true;
+}
+
+long long training_shard::write(DataLoader &loader, const std::string &base)
+{
+	ShardWriter writer(base);
+	for (size_t i = 0; i < loader.size(); i++)
+		writer.add(loader.example(i), loader.policy_entries());
+	long long n = writer.size();
+	return writer.close() ? n : -1;
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+#include "Constants.h"
+#include "GameRecord.h"
+#include "DataLoader.h"
+
+/*
+A shard of training positions that is read by mapping it into memory, without parsing.
+A shard with base name base is two files:
+
+base.index:	a Header, then one Record per position, each Header::stride bytes
+base.data:	a Header, then the policy entries of all positions, each an Entry
+
+so position i is at sizeof(Header) + i * stride in the index, and its policy entries are
+data entries record.policy_begin, ..., record.policy_begin + record.num_legal - 1.
+Both files are written in the byte order of the machine, which is little endian everywhere we run.
+The count of a header is only written once the shard is closed, so a shard that is still being written
+(or whose writer died) does not open.
+*/
+namespace training_shard
+{
+	const char INDEX_MAGIC[4] = {'C', 'P', 'S', 'I'};
+	const char DATA_MAGIC[4] = {'C', 'P', 'S', 'D'};
+	const uint16_t VERSION = 1;
+
+	struct Header
+	{
+		char magic[4];
+		uint16_t version;
+		uint8_t rows;
+		uint8_t cols;
+		uint8_t moves_per_square;
+		uint8_t metadata_length;
+		uint16_t stride;	// the size of a record or entry
+		uint64_t count;		// the number of records or entries
+	};
+
+	// a position, packed like the boards of GameRecord.h
+	struct Record
+	{
+		uint8_t board[game_record::BOARD_BYTES]; // square s in the low nibble of byte s / 2 if s is even, else the high one
+		uint8_t castling;						 // bit i is metadata[i] for i < 4
+		int8_t en_passant;						 // metadata[4]
+		int8_t value;							 // the result of the game from the point of view of the side to move
+		uint8_t reserved;
+		uint16_t num_legal;
+		uint16_t reserved2;
+		uint64_t policy_begin;
+
+		inline int piece(int s) const { return (board[s / 2] >> (4 * (s % 2))) & 0xf; }
+		inline int metadata(int i) const { return i < 4 ? (castling >> i) & 1 : en_passant; }
+	};
+
+	struct Entry
+	{
+		uint16_t index; // the policy index, r * COLS * MOVES_PER_SQUARE + c * MOVES_PER_SQUARE + i
+		uint16_t prob;	// the probability * 65535
+	};
+
+	static_assert(sizeof(Header) == 24, "shard headers are 24 bytes");
+	static_assert(sizeof(Record) == 48, "shard records are 48 bytes");
+	static_assert(sizeof(Entry) == 4, "shard entries are 4 bytes");
+
+	// writes every example loaded by loader, in the order they were read, to the shard base.
+	// this is how game files of any format are converted. returns the number of positions written, or -1 on failure.
+	long long write(DataLoader &loader, const std::string &base);
+}
+
+// appends positions to a new shard. not threadsafe.
+class ShardWriter
+{
+private:
+	std::ofstream index;
+	std::ofstream data;
+	uint64_t num_records = 0;
+	uint64_t num_entries = 0;
+	bool closed = false;
+
+	void write_header(std::ofstream &os, const char magic[4], uint16_t stride, uint64_t count);
+
+	void add(const int8_t *board, const int8_t *metadata, int value, const std::pair<uint16_t, float> *policy, int n);
+
+public:
+	explicit ShardWriter(const std::string &base);
+
+	ShardWriter(const ShardWriter &other) = delete;
+	ShardWriter &operator=(const ShardWriter &other) = delete;
+
+	inline ~ShardWriter() { close(); }
+
+	inline bool ok() { return index.good() && data.good(); }
+
+	// adds the positions of a finished game. result is 1 if white won, -1 if black won and 0 for a draw.
+	void add_game(const std::vector<game_record::MoveRecord> &moves, int result);
+
+	// adds ex, whose policy entries start at entries[ex.policy_begin].
+	void add(const DataLoader::Example &ex, const std::pair<uint16_t, float> *entries);
+
+	// writes the counts to the headers and closes the files. returns whether everything was written.
+	bool close();
+
+	inline uint64_t size() { return num_records; }
+};
+
+// maps a shard read only, or reads it into memory where mmap is not available (see map_file).
+// records and policies are views into the mapping, valid while the reader lives.
+class ShardReader
+{
+private:
+	void *index_map = nullptr;
+	void *data_map = nullptr;
+	size_t index_bytes = 0;
+	size_t data_bytes = 0;
+	const training_shard::Record *records = nullptr;
+	const training_shard::Entry *entries = nullptr;
+	uint64_t num_records = 0;
+	uint64_t num_entries = 0;
+
+public:
+	explicit ShardReader(const std::string &base);
+
+	ShardReader(const ShardReader &other) = delete;
+	ShardReader &operator=(const ShardReader &other) = delete;
+
+	~ShardReader();
+
+	// whether both files were mapped and their headers match this build
+	inline bool ok() { return records != nullptr; }
+
+	inline uint64_t size() { return num_records; }
+
+	inline const training_shard::Record &record(uint64_t i) { return records[i]; }
+
+	// the policy entries of r, r.num_legal of them
+	inline const training_shard::Entry *policy(const training_shard::Record &r) { return entries + r.policy_begin; }
+
+	/*
+	writes position i to row b of the buffers of DataLoader::next_batch, with the probabilities normalized.
+	returns false, writing nothing, if i is out of range or its policy lies outside the data file.
+	*/
+	bool fill(uint64_t i, int b, int *boards, int *metadata, float *policy, int *legal_moves, float *values);
+};
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <stdint.h>
+#include <stddef.h>
+
+// positions with more legal moves than this are not cached.
+const int TT_MAX_CHILDREN = 64;
+
+// a cached network evaluation of a position.
+// children has the same layout as the leaves of an MCTSNode: (uint16 move, uint8 prob) per child,
+// sorted by decreasing probability.
+struct TTEntry
+{
+	uint64_t key;
+	float q; // relative to the side to move
+	uint8_t num_children;
+	uint8_t referenced; // clock bit; set on every hit, cleared when the clock hand passes over the entry
+	uint8_t children[3 * TT_MAX_CHILDREN];
+};
+
+/*
+A fixed size hash table of network evaluations keyed by Position::key().
+Lets MCTS::select resolve positions that were already evaluated without sending them to the network again.
+The table is set associative with ways_per_bucket entries per bucket, and a full bucket evicts with the clock algorithm.
+If shared is true, the table can be used by many threads at once (each bucket is guarded by a spinlock);
+otherwise it is not threadsafe.
+*/
+class TranspositionTable
+{
+private:
+	static const int ways_per_bucket = 4;
+	std::vector<TTEntry> table;
+	std::vector<uint8_t> hands; // the clock hand of each bucket
+	std::unique_ptr<std::atomic_flag[]> locks;
+	uint64_t bucket_mask;
+	bool shared;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> stores;
+	std::atomic<uint64_t> evictions;
+
+	inline void lock(uint64_t bucket)
+	{
+		if (shared)
+			while (locks[bucket].test_and_set(std::memory_order_acquire))
+				;
+	}
+
+	inline void unlock(uint64_t bucket)
+	{
+		if (shared)
+			locks[bucket].clear(std::memory_order_release);
+	}
+
+public:
+	// the number of buckets is the largest power of two that fits in size_mb megabytes (at least one).
+	TranspositionTable(size_t size_mb, bool shared = false) : bucket_mask(0), shared(shared),
+															  hits(0), misses(0), stores(0), evictions(0)
+	{
+		size_t n = 1;
+		while (n * 2 * ways_per_bucket * sizeof(TTEntry) <= size_mb * 1024 * 1024)
+			n *= 2;
+		table.resize(n * ways_per_bucket);
+		hands.resize(n, 0);
+		locks.reset(new std::atomic_flag[n]);
+		for (size_t i = 0; i < n; i++)
+			locks[i].clear();
+		bucket_mask = n - 1;
+		clear();
+	}
+
+	TranspositionTable(const TranspositionTable &other) = delete;
+	TranspositionTable &operator=(const TranspositionTable &other) = delete;
+
+	// copies the entry for key into entry and returns true, or returns false if it is not in the table.
+	inline bool probe(uint64_t key, TTEntry &entry)
+	{
+		uint64_t bucket = key & bucket_mask;
+		TTEntry *ways = &table[bucket * ways_per_bucket];
+		lock(bucket);
+		for (int i = 0; i < ways_per_bucket; i++)
+		{
+			if (ways[i].num_children > 0 && ways[i].key == key)
+			{
+				ways[i].referenced = 1;
+				memcpy(&entry, &ways[i], sizeof(TTEntry));
+				unlock(bucket);
+				hits.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		unlock(bucket);
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// stores an evaluation. children is in the MCTSNode leaf layout.
+	inline void store(uint64_t key, float q, const uint8_t *children, size_t num_children)
+	{
+		if (num_children == 0 || num_children > TT_MAX_CHILDREN)
+			return;
+		uint64_t bucket = key & bucket_mask;
+		TTEntry *ways = &table[bucket * ways_per_bucket];
+		lock(bucket);
+		TTEntry *victim = nullptr;
+		for (int i = 0; i < ways_per_bucket && !victim; i++)
+		{
+			if (ways[i].num_children == 0 || ways[i].key == key)
+				victim = &ways[i];
+		}
+		if (!victim)
+		{
+			// advance the clock hand, giving referenced entries a second chance.
+			uint8_t &hand = hands[bucket];
+			while (ways[hand].referenced)
+			{
+				ways[hand].referenced = 0;
+				hand = (hand + 1) % ways_per_bucket;
+			}
+			victim = &ways[hand];
+			hand = (hand + 1) % ways_per_bucket;
+			evictions.fetch_add(1, std::memory_order_relaxed);
+		}
+		victim->key = key;
+		victim->q = q;
+		victim->num_children = (uint8_t)num_children;
+		victim->referenced = 0;
+		memcpy(victim->children, children, 3 * num_children);
+		unlock(bucket);
+		stores.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void clear()
+	{
+		for (TTEntry &e : table)
+		{
+			e.key = 0;
+			e.num_children = 0;
+			e.referenced = 0;
+		}
+	}
+
+	// the number of entries
+	inline size_t size() { return table.size(); }
+
+	inline bool is_shared() { return shared; }
+
+	inline uint64_t num_hits() { return hits.load(std::memory_order_relaxed); }
+
+	inline uint64_t num_misses() { return misses.load(std::memory_order_relaxed); }
+
+	inline uint64_t num_stores() { return stores.load(std::memory_order_relaxed); }
+
+	inline uint64_t num_evictions() { return evictions.load(std::memory_order_relaxed); }
+
+	inline double hit_rate()
+	{
+		uint64_t h = num_hits(), m = num_misses();
+		return h + m > 0 ? h / (double)(h + m) : 0.0;
+	}
+};
@@ -7,10 +7,15 @@ def s(x):
     system(x)
 
 
-if len(sys.argv) >= 2:
+# --pext indexes the slider attack tables with the BMI2 pext instruction (see tables.h). only use it on cpus
+# where pext is fast; without it, magic bitboards are used.
+args = [a for a in sys.argv[1:] if a != "--pext"]
+if len(args) >= 1:
     opt = ""
 else:
     opt = "-Ofast"
+if "--pext" in sys.argv[1:]:
+    opt += " -mbmi2 -DUSE_PEXT"
 
 files = [
     "BatchMCTS.cpp",
@@ -24,6 +29,11 @@ files = [
     "tbprobe.cpp",
     "tablebase_evaluation.cpp",
     "memmanager.cpp",
+    "GameRecord.cpp",
+    "DataLoader.cpp",
+    "ReplayBuffer.cpp",
+    "TrainingShard.cpp",
+    "perft.cpp",
 ]
 files = [f.replace(".cpp", "") for f in files]
 for f in files:
@@ -1,6 +1,9 @@
 #include <iostream>
 #include "ndarray.h"
 #include "BatchMCTS.h"
+#include "DataLoader.h"
+#include "ReplayBuffer.h"
+#include "TrainingShard.h"
 #include "tablebase_evaluation.h"
 extern "C"
 {
@@ -53,7 +56,10 @@ extern "C"
                                    int num_sectors,
                                    float cpuct,
                                    numpyArray<int> boards_,
-                                   numpyArray<int> metadata_)
+                                   numpyArray<int> metadata_,
+                                   int leaves_per_tree,
+                                   bool pin_threads,
+                                   bool thread_arenas)
         {
             Ndarray<int, 3> boards(boards_);
             Ndarray<int, 2> metadata(metadata_);
@@ -66,7 +72,10 @@ extern "C"
                                          num_sectors,
                                          cpuct,
                                          boards,
-                                         metadata);
+                                         metadata,
+                                         leaves_per_tree,
+                                         pin_threads,
+                                         thread_arenas);
             return m;
         }
 
@@ -87,6 +96,118 @@ extern "C"
             m->set_temperature(temp);
         }
 
+        void set_transposition_tables(BatchMCTS *m, int size_mb)
+        {
+            m->set_transposition_tables(size_mb);
+        }
+
+        void set_work_stealing(BatchMCTS *m, int chunk_size)
+        {
+            m->set_work_stealing(chunk_size);
+        }
+
+        // format is a RecordFormat: 0 for text, 1 for the format in GameRecord.h, 2 for moves only.
+        void set_record_format(BatchMCTS *m, int format)
+        {
+            m->set_record_format(RecordFormat(format));
+        }
+
+        // replays moves (n) from start_fen, or from the start position if it is empty, into boards (n, 8, 8), metadata (n, 5) and legal_moves (n, 8, 8, 73).
+        // returns the number of moves replayed, which is less than n if a move is illegal.
+        int replay_moves(numpyArray<unsigned short> moves_, numpyArray<int> boards_, numpyArray<int> metadata_, numpyArray<unsigned char> legal_moves_, char *start_fen)
+        {
+            Ndarray<unsigned short, 1> moves(moves_);
+            Ndarray<int, 3> boards(boards_);
+            Ndarray<int, 2> metadata(metadata_);
+            Ndarray<unsigned char, 4> legal_moves(legal_moves_);
+            int n = (int)moves.getShape(0);
+            std::vector<uint16_t> move_list(n);
+            std::vector<int> board_buf(n * ROWS * COLS);
+            std::vector<int> metadata_buf(n * METADATA_LENGTH);
+            std::vector<uint8_t> legal_buf((size_t)n * ROWS * COLS * MOVES_PER_SQUARE);
+            for (int i = 0; i < n; i++)
+                move_list[i] = moves[i];
+            int replayed = game_record::replay(move_list.data(), n, board_buf.data(), metadata_buf.data(), legal_buf.data(), start_fen);
+            for (int i = 0; i < replayed; i++)
+            {
+                for (int r = 0; r < ROWS; r++)
+                {
+                    for (int c = 0; c < COLS; c++)
+                    {
+                        boards[i][r][c] = board_buf[(i * ROWS + r) * COLS + c];
+                        for (int k = 0; k < MOVES_PER_SQUARE; k++)
+                            legal_moves[i][r][c][k] = legal_buf[(((size_t)i * ROWS + r) * COLS + c) * MOVES_PER_SQUARE + k];
+                    }
+                }
+                for (int j = 0; j < METADATA_LENGTH; j++)
+                    metadata[i][j] = metadata_buf[i * METADATA_LENGTH + j];
+            }
+            return replayed;
+        }
+
+        void flush_games(BatchMCTS *m)
+        {
+            m->flush_games();
+        }
+
+        unsigned long long num_finished_games(BatchMCTS *m)
+        {
+            return m->num_finished_games();
+        }
+
+        void set_memory_limit(BatchMCTS *m, unsigned long long bytes_per_tree)
+        {
+            m->set_memory_limit(bytes_per_tree);
+        }
+
+        void set_snapshot_stride(BatchMCTS *m, int stride)
+        {
+            m->set_snapshot_stride(stride);
+        }
+
+        unsigned long long memory_usage(BatchMCTS *m)
+        {
+            return m->memory_usage();
+        }
+
+        void set_evaluation_cache(BatchMCTS *m, int size_mb)
+        {
+            m->set_evaluation_cache(size_mb);
+        }
+
+        // writes (hits, misses, stores, evictions) of the evaluation cache to stats. all zeros if there is none.
+        void evaluation_cache_stats(BatchMCTS *m, numpyArray<unsigned long long> stats_)
+        {
+            Ndarray<unsigned long long, 1> stats(stats_);
+            std::shared_ptr<TranspositionTable> cache = m->get_evaluation_cache();
+            stats[0] = cache ? cache->num_hits() : 0;
+            stats[1] = cache ? cache->num_misses() : 0;
+            stats[2] = cache ? cache->num_stores() : 0;
+            stats[3] = cache ? cache->num_evictions() : 0;
+        }
+
+        double evaluation_cache_hit_rate(BatchMCTS *m)
+        {
+            std::shared_ptr<TranspositionTable> cache = m->get_evaluation_cache();
+            return cache ? cache->hit_rate() : 0.0;
+        }
+
+        void set_tablebase_cache(BatchMCTS *m, int size_mb)
+        {
+            m->set_tablebase_cache(size_mb);
+        }
+
+        // writes (hits, misses, nanoseconds spent probing on misses) of the tablebase cache to stats.
+        // all zeros if there is none.
+        void tablebase_cache_stats(BatchMCTS *m, numpyArray<unsigned long long> stats_)
+        {
+            Ndarray<unsigned long long, 1> stats(stats_);
+            std::shared_ptr<TablebaseCache> cache = m->get_tablebase_cache();
+            stats[0] = cache ? cache->num_hits() : 0;
+            stats[1] = cache ? cache->num_misses() : 0;
+            stats[2] = cache ? cache->total_probe_nanoseconds() : 0;
+        }
+
         void wait_until_no_workers(BatchMCTS *m)
         {
             m->wait_until_no_workers();
@@ -117,5 +238,129 @@ extern "C"
         {
             return m->current_sector();
         }
+
+        // replay buffers are handed out as shared pointers, since BatchMCTS objects keep a reference to theirs.
+        std::shared_ptr<ReplayBuffer> *createReplayBuffer(unsigned long long capacity, int num_threads, unsigned long long seed)
+        {
+            return new std::shared_ptr<ReplayBuffer>(std::make_shared<ReplayBuffer>(capacity, num_threads, seed));
+        }
+
+        void deleteReplayBuffer(std::shared_ptr<ReplayBuffer> *buffer)
+        {
+            delete buffer;
+        }
+
+        // buffer may be null, which stops adding games to a replay buffer.
+        void set_replay_buffer(BatchMCTS *m, std::shared_ptr<ReplayBuffer> *buffer)
+        {
+            m->set_replay_buffer(buffer ? *buffer : nullptr);
+        }
+
+        unsigned long long replay_buffer_size(std::shared_ptr<ReplayBuffer> *buffer)
+        {
+            return (*buffer)->size();
+        }
+
+        unsigned long long replay_buffer_games_added(std::shared_ptr<ReplayBuffer> *buffer)
+        {
+            return (*buffer)->games_added();
+        }
+
+        // the arrays must be C contiguous; the batch size is the length of boards.
+        int replay_buffer_sample(std::shared_ptr<ReplayBuffer> *buffer,
+                                 double half_life,
+                                 numpyArray<int> boards,
+                                 numpyArray<int> metadata,
+                                 numpyArray<float> policy,
+                                 numpyArray<int> legal_moves,
+                                 numpyArray<float> values)
+        {
+            return (*buffer)->sample((int)boards.shape[0], half_life, boards.data, metadata.data, policy.data, legal_moves.data, values.data);
+        }
+
+        DataLoader *createDataLoader(int num_threads, bool shuffle, unsigned long long seed)
+        {
+            return new DataLoader(num_threads, shuffle, seed);
+        }
+
+        void deleteDataLoader(DataLoader *l)
+        {
+            delete l;
+        }
+
+        void data_loader_add_file(DataLoader *l, char *path)
+        {
+            l->add_file(path);
+        }
+
+        unsigned long long data_loader_load(DataLoader *l)
+        {
+            return l->load();
+        }
+
+        void data_loader_new_epoch(DataLoader *l)
+        {
+            l->new_epoch();
+        }
+
+        int data_loader_bad_files(DataLoader *l)
+        {
+            return l->bad_files();
+        }
+
+        // the arrays must be C contiguous; the batch size is the length of boards.
+        int data_loader_next_batch(DataLoader *l,
+                                   numpyArray<int> boards,
+                                   numpyArray<int> metadata,
+                                   numpyArray<float> policy,
+                                   numpyArray<int> legal_moves,
+                                   numpyArray<float> values)
+        {
+            return l->next_batch((int)boards.shape[0], boards.data, metadata.data, policy.data, legal_moves.data, values.data);
+        }
+
+        // writes the loaded examples to the shard path.index, path.data. returns the number written, or -1.
+        long long data_loader_write_shard(DataLoader *l, char *path)
+        {
+            return training_shard::write(*l, path);
+        }
+
+        // returns null if the shard cannot be opened.
+        ShardReader *openShard(char *path)
+        {
+            ShardReader *r = new ShardReader(path);
+            if (!r->ok())
+            {
+                delete r;
+                return nullptr;
+            }
+            return r;
+        }
+
+        void closeShard(ShardReader *r)
+        {
+            delete r;
+        }
+
+        unsigned long long shard_size(ShardReader *r)
+        {
+            return r->size();
+        }
+
+        // fills row b with position indices[b], for every b. returns the number of rows filled before the first bad index.
+        int shard_fill(ShardReader *r,
+                       numpyArray<unsigned long long> indices,
+                       numpyArray<int> boards,
+                       numpyArray<int> metadata,
+                       numpyArray<float> policy,
+                       numpyArray<int> legal_moves,
+                       numpyArray<float> values)
+        {
+            int n = (int)indices.shape[0];
+            for (int b = 0; b < n; b++)
+                if (!r->fill(indices.data[b], b, boards.data, metadata.data, policy.data, legal_moves.data, values.data))
+                    return b;
+            return n;
+        }
     }
 } // end extern "C"
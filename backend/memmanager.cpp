@@ -1,49 +1,110 @@
 #include "memmanager.h"
 #include <iostream>
-int64_t MemoryBlock::resize(uint32_t size)
+uint8_t *ChunkArena::get()
 {
-    std::cout << "resizing from " << this->size() << " bytes to " << size << " bytes. had " << count_free_memory() << " bytes free before\n";
-    uint8_t *newmemory = (uint8_t *)realloc(memory, size);
-    int64_t diff = newmemory - memory;
-    memory = newmemory;
-    frontier += diff; // newmemory + (frontier - memory)
-    wall = memory + size;
+    std::lock_guard<std::mutex> lock(m);
+    if (free_chunks.empty())
+    {
+        uint8_t *slab = (uint8_t *)malloc(chunk_size_ * chunks_per_slab);
+        if (!slab)
+            return nullptr;
+        slabs.push_back(slab);
+        for (size_t i = chunks_per_slab; i > 0; i--)
+            free_chunks.push_back(slab + (i - 1) * chunk_size_);
+    }
+    uint8_t *chunk = free_chunks.back();
+    free_chunks.pop_back();
+    chunks_in_use++;
+    return chunk;
+}
 
-    return diff;
+void ChunkArena::put(uint8_t *chunk)
+{
+    std::lock_guard<std::mutex> lock(m);
+    free_chunks.push_back(chunk);
+    chunks_in_use--;
 }
 
-uint8_t *MemoryBlock::malloc_(uint32_t size)
+bool MemoryBlock::add_chunk(size_t min_size)
 {
-    uint32_t cur = get_piece_size(size);
-    if (recycling.count(cur) && recycling[cur].size() > 0)
+    if (total_size + min_size > memory_limit)
+        return false;
+    uint8_t *chunk;
+    uint64_t size;
+    if (arena)
     {
-        uint32_t displacement = recycling[cur].back();
-        recycling[cur].pop_back();
-        return memory + displacement * starting_allocation_size;
+        size = arena->chunk_size();
+        if (min_size > size || total_size + size > memory_limit)
+            return false;
+        chunk = arena->get();
     }
-    if (frontier + cur > wall)
-        return nullptr;
+    else
+    {
+        // the chunk doubles the arena unless that goes past the limit, in which case it takes what is left.
+        size = std::max<uint64_t>(std::max<uint64_t>(total_size, starting_blocksize), min_size);
+        size = std::min<uint64_t>(size, memory_limit - total_size);
+        chunk = (uint8_t *)malloc(size);
+    }
+    if (!chunk)
+        return false;
+    // the rest of the current chunk is cut into the largest pieces that fit and put on the free lists.
+    for (int c = num_classes - 1; c >= 0; c--)
+    {
+        while (frontier && frontier + class_size(c) <= wall)
+        {
+            push_free(c, frontier);
+            frontier += class_size(c);
+        }
+    }
+    chunks.push_back(chunk);
+    total_size += size;
+    frontier = chunk;
+    wall = chunk + size;
+    return true;
+}
 
-    uint8_t *result = frontier;
-    frontier += cur;
+uint8_t *MemoryBlock::malloc_(size_t size)
+{
+    int c = get_class(size);
+    uint8_t *result = free_lists[c];
+    if (result)
+    {
+        memcpy(&free_lists[c], result, sizeof(uint8_t *));
+        free_pieces[c]--;
+    }
+    else
+    {
+        size_t cur = class_size(c);
+        if (frontier + cur > wall && !add_chunk(cur))
+            return nullptr;
+        result = frontier;
+        frontier += cur;
+    }
+    live_pieces[c]++;
+    requested += size;
     // std::cout << "malloc" << (long)result << "\t" << size << "\n";
     return result;
 }
 
-uint8_t *MemoryBlock::realloc_(uint8_t *ptr, uint32_t prevsize, uint32_t newsize)
+uint8_t *MemoryBlock::realloc_(uint8_t *ptr, size_t prevsize, size_t newsize)
 {
-    uint32_t cur = get_piece_size(prevsize);
-    if (newsize <= cur)
+    if (newsize <= class_size(get_class(prevsize)))
+    {
+        requested = requested - prevsize + newsize;
         return ptr;
+    }
     uint8_t *newptr = malloc_(newsize);
+    if (!newptr)
+        return nullptr;
     memcpy(newptr, ptr, std::min(prevsize, newsize));
     free_(ptr, prevsize);
     return newptr;
 }
 
-void MemoryBlock::free_(uint8_t *ptr, uint32_t size)
+void MemoryBlock::free_(uint8_t *ptr, size_t size)
 {
-    uint32_t cur = get_piece_size(size);
-    uint32_t displacement = (ptr - memory) / starting_allocation_size;
-    recycling[cur].push_back(displacement);
-}
\ No newline at end of file
+    int c = get_class(size);
+    live_pieces[c]--;
+    requested -= size;
+    push_free(c, ptr);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <stdint.h>
 #include <stddef.h>
@@ -9,92 +10,239 @@
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <mutex>
+#include <memory>
 class MemoryManager
 {
+protected:
+    uint64_t memory_limit = UINT64_MAX;
+
 public:
-    virtual uint8_t *malloc_(uint32_t size) = 0;
-    virtual uint8_t *realloc_(uint8_t *ptr, uint32_t prevsize, uint32_t newsize) = 0;
-    virtual void free_(uint8_t *ptr, uint32_t size) = 0;
-    virtual uint32_t memory_until_wall() = 0;
-    // TODO: size() may exceed 4GB in the future. consider fixing.
-    virtual uint32_t size() = 0;
-    virtual int64_t resize(uint32_t size) = 0;
+    virtual uint8_t *malloc_(size_t size) = 0;
+    virtual uint8_t *realloc_(uint8_t *ptr, size_t prevsize, size_t newsize) = 0;
+    virtual void free_(uint8_t *ptr, size_t size) = 0;
+    // the number of bytes currently taken from the system
+    virtual uint64_t size() = 0;
     virtual void reset() = 0;
+    virtual ~MemoryManager() {}
+
+    // true if reset() takes back everything that was allocated, so there is no need to free_ pieces one by one first.
+    virtual bool releases_in_bulk() { return false; }
+
+    // a hard cap on size(). allocations that would exceed it return nullptr.
+    inline void set_limit(uint64_t bytes) { memory_limit = bytes; }
+
+    inline uint64_t limit() { return memory_limit; }
 };
 
+// malloc and free, counting the bytes in use so that the memory limit can be enforced.
 class DefaultMemoryManager : public MemoryManager
 {
-    inline uint8_t *malloc_(uint32_t size) { return (uint8_t *)malloc(size); }
-    inline uint8_t *realloc_(uint8_t *ptr, uint32_t prevsize, uint32_t newsize) { return (uint8_t *)realloc(ptr, newsize); }
-    inline void free_(uint8_t *ptr, uint32_t size) { free(ptr); }
-    inline uint32_t memory_until_wall() { return (uint32_t)4e9; }
-    inline uint32_t size() { return (uint32_t)4e9; }
-    inline int64_t resize(uint32_t size) { return 0; }
+    uint64_t in_use = 0;
+
+public:
+    inline uint8_t *malloc_(size_t size)
+    {
+        if (in_use + size > memory_limit)
+            return nullptr;
+        uint8_t *res = (uint8_t *)malloc(size);
+        if (res)
+            in_use += size;
+        return res;
+    }
+    inline uint8_t *realloc_(uint8_t *ptr, size_t prevsize, size_t newsize)
+    {
+        if (newsize > prevsize && in_use + (newsize - prevsize) > memory_limit)
+            return nullptr;
+        uint8_t *res = (uint8_t *)realloc(ptr, newsize);
+        if (res)
+            in_use = in_use - prevsize + newsize;
+        return res;
+    }
+    inline void free_(uint8_t *ptr, size_t size)
+    {
+        free(ptr);
+        in_use -= size;
+    }
+    inline uint64_t size() { return in_use; }
     inline void reset() {}
 };
 
+/*
+A threadsafe source of fixed size chunks for MemoryBlocks, meant to be shared by the trees that one worker thread updates.
+Chunks are carved out of large slabs and recycled when a MemoryBlock is reset; memory goes back to the system only when
+the arena is destroyed. So trees that are reset every game reuse the same memory instead of going through malloc.
+*/
+class ChunkArena
+{
+private:
+    size_t const chunk_size_;
+    size_t const chunks_per_slab;
+    std::mutex m;
+    std::vector<uint8_t *> slabs;
+    std::vector<uint8_t *> free_chunks;
+    uint64_t chunks_in_use;
+
+public:
+    ChunkArena(size_t chunk_size, size_t chunks_per_slab) : chunk_size_(chunk_size), chunks_per_slab(chunks_per_slab), chunks_in_use(0) {}
+
+    ~ChunkArena()
+    {
+        for (uint8_t *slab : slabs)
+            free(slab);
+    }
+
+    ChunkArena(ChunkArena const &other) = delete;
+    ChunkArena &operator=(ChunkArena other) = delete;
+
+    // returns a chunk of chunk_size() bytes, or nullptr if the system is out of memory.
+    uint8_t *get();
+
+    // takes back a chunk from get().
+    void put(uint8_t *chunk);
+
+    inline size_t chunk_size() { return chunk_size_; }
+
+    // bytes taken from the system
+    inline uint64_t reserved_bytes()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return (uint64_t)slabs.size() * chunks_per_slab * chunk_size_;
+    }
+
+    // bytes handed out to MemoryBlocks
+    inline uint64_t used_bytes()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return chunks_in_use * chunk_size_;
+    }
+};
+
+/*
+An arena made of chunks. When the current chunk is full, a new chunk as large as all previous chunks combined is added,
+so the arena doubles like a realloc'd block would, but allocated memory never moves and pointers into it stay valid.
+Every allocation is rounded up to a size class of starting_allocation_size * 2^k bytes.
+Freed pieces go on an intrusive free list per size class: the first bytes of a free piece point to the next one.
+If the block is given a ChunkArena, every chunk is one chunk of the arena instead, and reset() returns them all to it.
+*/
 class MemoryBlock : public MemoryManager
 {
 
 private:
     static const uint32_t precalculate = 2048;
-    uint32_t const starting_allocation_size;
-    uint32_t const starting_blocksize;
-    uint8_t *memory;
-    uint8_t *frontier;
-    uint8_t *wall;
-    std::unordered_map<uint32_t, std::vector<uint32_t>> recycling;
-    std::vector<uint32_t> memotable;
+    static const int num_classes = 48;
+    size_t const starting_allocation_size;
+    size_t const starting_blocksize;
+    std::vector<uint8_t *> chunks;
+    std::shared_ptr<ChunkArena> arena; // where chunks come from; nullptr means malloc
+    uint64_t total_size;               // sum of the sizes of the chunks
+    uint8_t *frontier;   // the next free byte of the last chunk
+    uint8_t *wall;       // the end of the last chunk
+    uint8_t *free_lists[num_classes];
+    std::vector<uint8_t> memotable; // the size class of every size below precalculate
+
+    // stats
+    uint64_t live_pieces[num_classes];
+    uint64_t free_pieces[num_classes];
+    uint64_t requested; // bytes asked for by the live allocations, before rounding up to a size class
 
-    inline uint32_t get_piece_size(uint32_t size)
+    inline int get_class(size_t size)
     {
         if (size < precalculate)
             return memotable[size];
-        uint32_t cur = starting_allocation_size;
-        while (cur < size)
-            cur += cur;
-        return cur;
+        int c = 0;
+        while ((starting_allocation_size << c) < size)
+            c++;
+        return c;
+    }
+
+    inline void push_free(int c, uint8_t *ptr)
+    {
+        memcpy(ptr, &free_lists[c], sizeof(uint8_t *)); // pieces are not necessarily aligned
+        free_lists[c] = ptr;
+        free_pieces[c]++;
+    }
+
+    // adds a chunk that can hold at least min_size bytes. returns false if that would exceed the memory limit.
+    bool add_chunk(size_t min_size);
+
+    inline void free_chunks()
+    {
+        for (uint8_t *chunk : chunks)
+        {
+            if (arena)
+                arena->put(chunk);
+            else
+                free(chunk);
+        }
+        chunks.clear();
+    }
+
+    inline void clear_stats()
+    {
+        for (int c = 0; c < num_classes; c++)
+        {
+            free_lists[c] = nullptr;
+            live_pieces[c] = 0;
+            free_pieces[c] = 0;
+        }
+        requested = 0;
     }
 
 public:
-    // cannot hold more than starting_allocation_size * 2^32 bytes!
-    MemoryBlock(uint32_t const blocksize_,
-                uint32_t const starting_size_) : starting_allocation_size(starting_size_),
-                                                 starting_blocksize(blocksize_),
-                                                 memotable(precalculate, 0)
-    {
-        memory = (uint8_t *)malloc(blocksize_);
-        frontier = memory;
-        wall = memory + blocksize_;
-        uint32_t cur = starting_allocation_size;
-        for (int i = 0; i < precalculate; i++)
+    // starting_size_ is the smallest size class. it is raised to the size of a pointer if needed.
+    // with an arena, blocksize_ is ignored and no allocation may be larger than the arena's chunks.
+    MemoryBlock(size_t const blocksize_,
+                size_t const starting_size_,
+                uint64_t const limit_ = UINT64_MAX,
+                std::shared_ptr<ChunkArena> arena_ = nullptr) : starting_allocation_size(std::max(starting_size_, sizeof(uint8_t *))),
+                                                                starting_blocksize(arena_ ? arena_->chunk_size() : blocksize_),
+                                                                arena(arena_),
+                                                      total_size(0),
+                                                      frontier(nullptr),
+                                                      wall(nullptr),
+                                                      memotable(precalculate, 0)
+    {
+        clear_stats();
+        memory_limit = std::max<uint64_t>(limit_, starting_blocksize);
+        add_chunk(starting_blocksize);
+        int c = 0;
+        for (size_t i = 0; i < precalculate; i++)
         {
-            while (i > cur)
-            {
-                cur += cur;
-            }
-            memotable[i] = cur;
+            while (i > (starting_allocation_size << c))
+                c++;
+            memotable[i] = c;
         }
     }
 
     ~MemoryBlock()
     {
-        free(memory);
+        free_chunks();
     }
 
     MemoryBlock(MemoryBlock &&other) : starting_blocksize(other.starting_blocksize), starting_allocation_size(other.starting_allocation_size)
     {
-        recycling = std::move(other.recycling);
-        std::swap(memory, other.memory);
-        std::swap(frontier, other.frontier);
-        std::swap(wall, other.wall);
+        memotable = std::move(other.memotable);
+        std::swap(chunks, other.chunks);
+        arena = other.arena;
+        memory_limit = other.memory_limit;
+        total_size = other.total_size;
+        frontier = other.frontier;
+        wall = other.wall;
+        memcpy(free_lists, other.free_lists, sizeof(free_lists));
+        memcpy(live_pieces, other.live_pieces, sizeof(live_pieces));
+        memcpy(free_pieces, other.free_pieces, sizeof(free_pieces));
+        requested = other.requested;
+        other.total_size = 0;
+        other.frontier = other.wall = nullptr;
+        other.clear_stats();
     }
 
     MemoryBlock(MemoryBlock const &other) = delete;
     MemoryBlock &operator=(MemoryBlock other) = delete;
 
-    // returns the number of bytes remaining that are available in this block
-    inline uint32_t memory_until_wall()
+    // returns the number of bytes remaining in the current chunk
+    inline uint64_t memory_until_wall()
     {
         if (frontier < wall)
             return wall - frontier;
@@ -102,30 +250,59 @@ public:
             return 0;
     }
 
-    inline uint32_t size() { return wall - memory; }
+    inline uint64_t size() { return total_size; }
+
+    inline size_t num_chunks() { return chunks.size(); }
+
+    // the size in bytes of the pieces of size class c
+    inline size_t class_size(int c) { return starting_allocation_size << c; }
+
+    inline int get_num_classes() { return num_classes; }
+
+    // the number of allocated pieces of size class c
+    inline uint64_t num_live(int c) { return live_pieces[c]; }
+
+    // the number of pieces of size class c on its free list
+    inline uint64_t num_free(int c) { return free_pieces[c]; }
+
+    // bytes in allocated pieces
+    inline uint64_t live_bytes()
+    {
+        uint64_t tot = 0;
+        for (int c = 0; c < num_classes; c++)
+            tot += live_pieces[c] * class_size(c);
+        return tot;
+    }
+
+    // bytes asked for by the allocated pieces
+    inline uint64_t requested_bytes() { return requested; }
 
-    inline uint32_t count_free_memory()
+    inline uint64_t count_free_memory()
     {
-        uint32_t tot = 0;
-        for (auto i : recycling)
-            tot += i.second.size() * i.first;
+        uint64_t tot = 0;
+        for (int c = 0; c < num_classes; c++)
+            tot += free_pieces[c] * class_size(c);
         return tot + memory_until_wall();
     }
 
+    // the fraction of the arena that does not hold requested bytes: rounding up to size classes,
+    // pieces on the free lists and the unused ends of chunks.
+    inline double fragmentation() { return total_size > 0 ? 1.0 - requested / (double)total_size : 0.0; }
+
     inline void reset()
     {
-        memory = (uint8_t *)realloc(memory, starting_blocksize);
-        frontier = memory;
-        wall = memory + starting_blocksize;
-        recycling.clear();
+        free_chunks();
+        total_size = 0;
+        frontier = wall = nullptr;
+        clear_stats();
+        add_chunk(starting_blocksize);
     }
 
+    inline bool releases_in_bulk() { return true; }
+
     // returns nullptr if allocation was unsuccessful,
     // and the pointer otherwise
-    uint8_t *malloc_(uint32_t size);
-    uint8_t *realloc_(uint8_t *ptr, uint32_t prevsize, uint32_t newsize);
-    void free_(uint8_t *ptr, uint32_t size);
-    // resizes the underlying memory array and returns new_address - old_address
-    // add the return value to each pointer allocated to get new valid pointer
-    int64_t resize(uint32_t size);
-};
\ No newline at end of file
+    uint8_t *malloc_(size_t size);
+    uint8_t *realloc_(uint8_t *ptr, size_t prevsize, size_t newsize);
+    void free_(uint8_t *ptr, size_t size);
+};
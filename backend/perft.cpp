@@ -0,0 +1,104 @@
+#include "perft.h"
+#include <chrono>
+
+namespace perft
+{
+	// counts from https://www.chessprogramming.org/Perft_Results
+	const std::vector<Case> SUITE = {
+		{"start", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+		{"kiwipete", KIWIPETE, 4, 4085603},
+		{"rook endgame, en passant and checks", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624},
+		{"promotions and castling", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},
+		{"promotions and castling, mirrored", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 4, 422333},
+		{"underpromotion", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+		{"middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+	};
+
+	// depth is at least 1. leaves are counted without playing or storing their moves.
+	template <Color Us>
+	static uint64_t count_from(Position &p, int depth, PerftTable *table)
+	{
+		uint64_t nodes = 0;
+		uint64_t key = 0;
+		if (table && depth > 1)
+		{
+			key = p.key();
+			if (table->probe(key, depth, nodes))
+				return nodes;
+		}
+		if (depth == 1)
+			return p.count_legals<Us>();
+		MoveList<Us> list(p);
+		for (Move move : list)
+		{
+			p.play<Us>(move);
+			nodes += count_from<~Us>(p, depth - 1, table);
+			p.undo<Us>(move);
+		}
+		if (table)
+			table->store(key, depth, nodes);
+		return nodes;
+	}
+
+	// depth is at least 2. every worker counts the root moves it is given on its own copy of p.
+	template <Color Us>
+	static uint64_t count_split(Position &p, int depth, ThreadPool &pool, PerftTable *table)
+	{
+		MoveList<Us> list(p);
+		std::vector<Move> moves(list.begin(), list.end());
+		std::vector<uint64_t> counts(moves.size(), 0);
+		pool.parallel_for(0, (int)moves.size(), 1, [&](int begin, int end)
+						  {
+			Position q = p;
+			for (int i = begin; i < end; i++)
+			{
+				q.play<Us>(moves[i]);
+				counts[i] = count_from<~Us>(q, depth - 1, table);
+				q.undo<Us>(moves[i]);
+			} });
+		uint64_t nodes = 0;
+		for (uint64_t c : counts)
+			nodes += c;
+		return nodes;
+	}
+
+	uint64_t count(Position &p, int depth, ThreadPool *pool, PerftTable *table)
+	{
+		if (depth <= 0)
+			return 1;
+		if (pool && depth > 1)
+			return p.turn() == WHITE ? count_split<WHITE>(p, depth, *pool, table) : count_split<BLACK>(p, depth, *pool, table);
+		return p.turn() == WHITE ? count_from<WHITE>(p, depth, table) : count_from<BLACK>(p, depth, table);
+	}
+
+	int run_suite(std::ostream &os, ThreadPool *pool, PerftTable *table)
+	{
+		int wrong = 0;
+		double total_seconds = 0;
+		uint64_t total_nodes = 0;
+		for (const Case &c : SUITE)
+		{
+			Position p;
+			Position::set(c.fen, p);
+			// every case starts from an empty table, so that its time does not depend on the cases before it.
+			if (table)
+				table->clear();
+			auto start = std::chrono::steady_clock::now();
+			uint64_t nodes = count(p, c.depth, pool, table);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			total_seconds += seconds;
+			total_nodes += nodes;
+			os << c.name << ", perft " << c.depth << ": " << nodes << " nodes in " << seconds << " s, "
+			   << nodes / seconds / 1e6 << " million nodes per second";
+			if (nodes != c.nodes)
+			{
+				os << ", expected " << c.nodes;
+				wrong++;
+			}
+			os << "\n";
+		}
+		os << "total: " << total_nodes << " nodes in " << total_seconds << " s, "
+		   << total_nodes / total_seconds / 1e6 << " million nodes per second\n";
+		return wrong;
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include "position.h"
+#include "ThreadPool.h"
+
+/*
+A hash table of perft results keyed by Position::key() and the depth, shared by all threads of a perft
+without locks. Every slot holds key ^ data and data, where data is nodes << 8 | depth: a slot that was
+torn by two threads writing it at once does not check out and reads as a miss.
+Every store replaces what was in the slot.
+*/
+class PerftTable
+{
+private:
+	struct Slot
+	{
+		std::atomic<uint64_t> check; // key ^ data
+		std::atomic<uint64_t> data;
+	};
+	std::unique_ptr<Slot[]> slots;
+	uint64_t mask;
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+
+public:
+	// the number of slots is the largest power of two that fits in size_mb megabytes (at least one).
+	PerftTable(size_t size_mb) : mask(0), hits(0), misses(0)
+	{
+		size_t n = 1;
+		while (n * 2 * sizeof(Slot) <= size_mb * 1024 * 1024)
+			n *= 2;
+		slots.reset(new Slot[n]);
+		mask = n - 1;
+		clear();
+	}
+
+	PerftTable(const PerftTable &other) = delete;
+	PerftTable &operator=(const PerftTable &other) = delete;
+
+	inline bool probe(uint64_t key, int depth, uint64_t &nodes)
+	{
+		Slot &s = slots[key & mask];
+		uint64_t data = s.data.load(std::memory_order_relaxed);
+		if ((s.check.load(std::memory_order_relaxed) ^ data) == key && (int)(data & 0xff) == depth)
+		{
+			nodes = data >> 8;
+			hits.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		misses.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	inline void store(uint64_t key, int depth, uint64_t nodes)
+	{
+		Slot &s = slots[key & mask];
+		uint64_t data = nodes << 8 | (uint64_t)depth;
+		s.check.store(key ^ data, std::memory_order_relaxed);
+		s.data.store(data, std::memory_order_relaxed);
+	}
+
+	inline void clear()
+	{
+		for (uint64_t i = 0; i <= mask; i++)
+		{
+			// a zero key with depth 0 is never probed, since depth 1 is counted without the table.
+			slots[i].check.store(0, std::memory_order_relaxed);
+			slots[i].data.store(0, std::memory_order_relaxed);
+		}
+		hits = 0;
+		misses = 0;
+	}
+
+	inline uint64_t num_hits() { return hits.load(); }
+	inline uint64_t num_misses() { return misses.load(); }
+};
+
+/*
+Perft counts the leaves of the tree of legal moves to a given depth. Comparing the counts with known
+values checks move generation, and the time they take is a measure of its speed.
+*/
+namespace perft
+{
+	// a position with its known perft.
+	struct Case
+	{
+		std::string name;
+		std::string fen;
+		int depth;
+		uint64_t nodes;
+	};
+
+	// the start position, kiwipete, and positions with promotions, en passant, castling and checks for both sides.
+	extern const std::vector<Case> SUITE;
+
+	// the number of leaves at depth of p, which is left as it was. with a pool, the root moves are split between
+	// its workers. with a table, counts of subtrees at depth 2 or more are looked up and stored in it.
+	uint64_t count(Position &p, int depth, ThreadPool *pool = nullptr, PerftTable *table = nullptr);
+
+	// runs every case of SUITE, printing its count, time and nodes per second to os.
+	// returns the number of cases whose count was wrong.
+	int run_suite(std::ostream &os, ThreadPool *pool = nullptr, PerftTable *table = nullptr);
+}
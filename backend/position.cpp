@@ -5,6 +5,9 @@
 // Zobrist keys for each piece and each square
 // Used to incrementally update the hash key of a position
 uint64_t zobrist::zobrist_table[NPIECES][NSQUARES];
+uint64_t zobrist::side_key;
+uint64_t zobrist::castling_keys[16];
+uint64_t zobrist::ep_keys[NSQUARES + 1];
 
 // Initializes the zobrist table with random 64-bit numbers
 void zobrist::initialise_zobrist_keys()
@@ -13,6 +16,12 @@ void zobrist::initialise_zobrist_keys()
 	for (int i = 0; i < NPIECES; i++)
 		for (int j = 0; j < NSQUARES; j++)
 			zobrist::zobrist_table[i][j] = rng.rand<uint64_t>();
+	zobrist::side_key = rng.rand<uint64_t>();
+	for (int i = 0; i < 16; i++)
+		zobrist::castling_keys[i] = rng.rand<uint64_t>();
+	for (int i = 0; i < NSQUARES; i++)
+		zobrist::ep_keys[i] = rng.rand<uint64_t>();
+	zobrist::ep_keys[NO_SQUARE] = 0;
 }
 
 // Pretty-prints the position (including FEN and hash key)
@@ -38,7 +47,6 @@ std::ostream &operator<<(std::ostream &os, const Position &p)
 }
 
 std::string Position::start_pos = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -";
-int Position::max_moves_without_pawn_move_or_captures = 30;
 
 // Returns the FEN (Forsyth-Edwards Notation) representation of the position
 std::string Position::fen() const
@@ -75,8 +83,8 @@ std::string Position::fen() const
 		<< (history[game_ply].entry & BLACK_OOO_MASK ? "" : "q")
 		<< (history[game_ply].entry & ALL_CASTLING_MASK ? "-" : "")
 		<< (history[game_ply].epsq == NO_SQUARE ? " -" : " " + std::string(SQSTR[history[game_ply].epsq]))
-		<< " " << ply_without_capture_or_pawn_move.back()
-		<< " " << ply_without_capture_or_pawn_move.back() + 1;
+		<< " " << history[game_ply].rule50
+		<< " " << history[game_ply].rule50 + 1;
 	return fen.str();
 }
 
@@ -124,6 +132,10 @@ void Position::set(const std::string &fen, Position &p)
 			break;
 		}
 	}
+
+	// earlier positions are not part of the new game
+	p.history[p.game_ply].rule50 = 0;
+	p.hash_history[p.game_ply] = p.hash;
 }
 
 // Moves a piece to a (possibly empty) square on the board and updates the hash
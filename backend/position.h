@@ -5,7 +5,8 @@
 #include <string>
 #include "tables.h"
 #include <utility>
-#include <unordered_map>
+#include <algorithm>
+#include <cstring>
 #include <string>
 
 // A psuedorandom number generator
@@ -38,6 +39,9 @@ public:
 namespace zobrist
 {
 	extern uint64_t zobrist_table[NPIECES][NSQUARES];
+	extern uint64_t side_key;
+	extern uint64_t castling_keys[16];
+	extern uint64_t ep_keys[NSQUARES + 1];
 	extern void initialise_zobrist_keys();
 }
 
@@ -55,7 +59,10 @@ struct UndoInfo
 	// double pushed on the previous move
 	Square epsq;
 
-	constexpr UndoInfo() : entry(0), captured(NO_PIECE), epsq(NO_SQUARE) {}
+	// The number of plies since the last capture or pawn move. Positions before that cannot repeat
+	uint16_t rule50;
+
+	constexpr UndoInfo() : entry(0), captured(NO_PIECE), epsq(NO_SQUARE), rule50(0) {}
 
 	// commented out to preserve the correctness of copy constructor and copy assignment operator
 	/*
@@ -64,7 +71,27 @@ struct UndoInfo
 	*/
 
 	// This preserves the entry bitboard across moves
-	UndoInfo(const Bitboard &entry) : entry(entry), captured(NO_PIECE), epsq(NO_SQUARE) {}
+	UndoInfo(const Bitboard &entry) : entry(entry), captured(NO_PIECE), epsq(NO_SQUARE), rule50(0) {}
+};
+
+// A copy of everything a Position needs to continue from the current ply: the board, the side to move, the
+// castling rights, en passant square and rule 50 counter, and the hashes of the plies a repetition can reach back to.
+// It is trivially copyable and much smaller than a Position. Moves cannot be undone past the ply it was saved at.
+struct PositionSnapshot
+{
+	// the most plies a repetition can reach back to. the game is a draw before the rule 50 counter gets there.
+	static constexpr int REPETITION_WINDOW = 64;
+
+	Bitboard piece_bb[NPIECES];
+	Piece board[NSQUARES];
+	Color side_to_play;
+	int game_ply;
+	uint64_t hash;
+	UndoInfo info;
+
+	// hashes[i] is the hash of ply game_ply - num_hashes + 1 + i
+	int num_hashes;
+	uint64_t hashes[REPETITION_WINDOW];
 };
 
 class Position
@@ -73,7 +100,10 @@ private:
 	// starting position fen
 	static std::string start_pos;
 
-	static int max_moves_without_pawn_move_or_captures;
+	static constexpr int max_moves_without_pawn_move_or_captures = 30;
+	// snapshots keep the hashes of every ply since the last capture or pawn move; the game is a draw before they run out.
+	static_assert(2 * max_moves_without_pawn_move_or_captures < PositionSnapshot::REPETITION_WINDOW,
+				  "PositionSnapshot::REPETITION_WINDOW is too small for the rule 50 limit");
 
 	// A bitboard of the locations of each piece
 	Bitboard piece_bb[NPIECES];
@@ -91,12 +121,20 @@ private:
 	// make/unmake
 	uint64_t hash;
 
-	// a map of hash -> count, indicating the number of times that we have seen a position.
-	// used to calculate draws by repetition
-	std::unordered_map<uint64_t, uint16_t> position_history;
+	// The hash of the position after each ply, used to detect draws by repetition. Only the last
+	// history[game_ply].rule50 entries are scanned, since a capture or pawn move cannot be undone
+	uint64_t hash_history[1024];
 
-	// a history of number of ply w/o capture or pawn move
-	std::vector<int> ply_without_capture_or_pawn_move;
+	// returns true if the position occurred twice before with the same side to move, i.e. this is its third occurrence
+	inline bool is_threefold_repetition() const
+	{
+		int count = 0;
+		const int end = std::max(game_ply - history[game_ply].rule50, 0);
+		for (int i = game_ply - 4; i >= end; i -= 2)
+			if (hash_history[i] == hash && ++count == 2)
+				return true;
+		return false;
+	}
 
 public:
 	// The history of non-recoverable information
@@ -111,7 +149,7 @@ public:
 	Bitboard pinned;
 
 	Position() : piece_bb{0}, side_to_play(WHITE), game_ply(0), board{},
-				 hash(0), pinned(0), checkers(0), position_history(), ply_without_capture_or_pawn_move()
+				 hash(0), pinned(0), checkers(0)
 	{
 
 		// Sets all squares on the board as empty
@@ -121,12 +159,6 @@ public:
 
 		// sets the starting position
 		set(start_pos, *this);
-
-		// adds current position to the current position
-		position_history[get_hash()] = 1;
-
-		// adds 0 to moves without capture or pawn move
-		ply_without_capture_or_pawn_move.push_back(0);
 	}
 
 	// Places a piece on a particular square and updates the hash. Placing a piece on a square that is
@@ -162,7 +194,42 @@ public:
 	inline Color turn() const { return side_to_play; }
 	inline int ply() const { return game_ply; }
 	inline uint64_t get_hash() const { return hash; }
-	inline int num_ply_no_capture_or_pawn_move() const { return ply_without_capture_or_pawn_move.back(); }
+
+	// the hash extended with the side to move, castling rights and en passant square,
+	// i.e. everything that is written by writePosition. Used to key cached evaluations.
+	inline uint64_t key() const
+	{
+		const Bitboard entry = history[game_ply].entry;
+		int castling = ((entry & WHITE_OO_MASK) == 0) | ((entry & WHITE_OOO_MASK) == 0) << 1 |
+					   ((entry & BLACK_OO_MASK) == 0) << 2 | ((entry & BLACK_OOO_MASK) == 0) << 3;
+		return hash ^ (side_to_play == BLACK ? zobrist::side_key : 0) ^
+			   zobrist::castling_keys[castling] ^ zobrist::ep_keys[history[game_ply].epsq];
+	}
+	inline int num_ply_no_capture_or_pawn_move() const { return history[game_ply].rule50; }
+
+	inline void save(PositionSnapshot &s) const
+	{
+		memcpy(s.piece_bb, piece_bb, sizeof(piece_bb));
+		memcpy(s.board, board, sizeof(board));
+		s.side_to_play = side_to_play;
+		s.game_ply = game_ply;
+		s.hash = hash;
+		s.info = history[game_ply];
+		s.num_hashes = std::min(std::min((int)history[game_ply].rule50, game_ply) + 1, PositionSnapshot::REPETITION_WINDOW);
+		memcpy(s.hashes, hash_history + game_ply - s.num_hashes + 1, s.num_hashes * sizeof(uint64_t));
+	}
+
+	// continues from s as if its moves had been played here. moves played before s cannot be undone afterwards.
+	inline void restore(const PositionSnapshot &s)
+	{
+		memcpy(piece_bb, s.piece_bb, sizeof(piece_bb));
+		memcpy(board, s.board, sizeof(board));
+		side_to_play = s.side_to_play;
+		game_ply = s.game_ply;
+		hash = s.hash;
+		history[game_ply] = s.info;
+		memcpy(hash_history + game_ply - s.num_hashes + 1, s.hashes, s.num_hashes * sizeof(uint64_t));
+	}
 
 	template <Color C>
 	inline Bitboard diagonal_sliders() const;
@@ -183,8 +250,17 @@ public:
 	void play(Move m);
 	template <Color C>
 	void undo(Move m);
+	// list is a Move *, which gets the moves and is returned advanced past them, or a MoveCounter.
+	template <Color Us, typename List = Move *>
+	List generate_legals(List list);
+
+	// the number of legal moves, counted without storing them.
+	template <Color Us>
+	inline size_t count_legals() { return generate_legals<Us>(MoveCounter()).n; }
+
+	// whether there is a legal move. stops looking as soon as the king has one, which is most of the time.
 	template <Color Us>
-	Move *generate_legals(Move *list);
+	inline bool has_legal_move() { return generate_legals<Us>(MoveCounter(1)).n > 0; }
 };
 
 // Returns the bitboard of all bishops and queens of a given color
@@ -364,29 +440,15 @@ void Position::play(const Move m)
 		break;
 	}
 
-	auto h = get_hash();
-	if (position_history.count(h))
-		position_history[h]++;
-	else
-		position_history[h] = 1;
 	if (add)
-		ply_without_capture_or_pawn_move.push_back(ply_without_capture_or_pawn_move.back() + 1);
-	else
-		ply_without_capture_or_pawn_move.push_back(0);
+		history[game_ply].rule50 = history[game_ply - 1].rule50 + 1;
+	hash_history[game_ply] = hash;
 }
 
 // Undos a move in the current position, rolling it back to the previous position
 template <Color C>
 void Position::undo(const Move m)
 {
-	ply_without_capture_or_pawn_move.pop_back();
-	auto h = get_hash();
-	auto cnt = position_history.count(h);
-	if (cnt >= 2)
-		position_history[h]--;
-	else if (cnt == 1)
-		position_history.erase(h);
-
 	MoveFlags type = m.flags();
 	switch (type)
 	{
@@ -450,10 +512,10 @@ void Position::undo(const Move m)
 }
 
 // Generates all legal moves in a position for the given side. Advances the move pointer and returns it.
-template <Color Us>
-Move *Position::generate_legals(Move *list)
+template <Color Us, typename List>
+List Position::generate_legals(List list)
 {
-	if (num_ply_no_capture_or_pawn_move() >= 2 * max_moves_without_pawn_move_or_captures || (position_history.count(get_hash()) == 1 && position_history[get_hash()] >= 3)) // the game is a draw.
+	if (num_ply_no_capture_or_pawn_move() >= 2 * max_moves_without_pawn_move_or_captures || is_threefold_repetition()) // the game is a draw.
 		return list;
 
 	constexpr Color Them = ~Us;
@@ -500,6 +562,8 @@ Move *Position::generate_legals(Move *list)
 	b1 = attacks<KING>(our_king, all) & ~(us_bb | danger);
 	list = make<QUIET>(our_king, b1 & ~them_bb, list);
 	list = make<CAPTURE>(our_king, b1 & them_bb, list);
+	if (enough_moves(list))
+		return list;
 
 	// The capture mask filters destination squares to those that contain an enemy piece that is checking the
 	// king and must be captured
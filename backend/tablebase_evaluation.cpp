@@ -3,11 +3,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "position.h"
 #include "tbprobe.h"
 #include "tablebase_evaluation.h"
 #include <string>
 #include <iostream>
+#include <chrono>
 
+#define BOARD_RANK_1 0x00000000000000FFull
+#define BOARD_FILE_A 0x8080808080808080ull
+#define square(r, f) (8 * (r) + (f))
+#define rank(s) ((s) >> 3)
+#define file(s) ((s)&0x07)
+#define board(s) ((uint64_t)1 << (s))
+
+/*
+ * Parse a FEN string.
+ */
 static bool parse_FEN(struct pos *pos, const char *fen)
 {
     uint64_t white = 0, black = 0;
@@ -205,6 +217,31 @@ fen_parse_error:
     return false;
 }
 
+// wdl is from the point of view of the side to move: 0 is a loss, 4 a win, and 1, 2, 3 (blessed loss, draw,
+// cursed win) are draws under the 50 move rule. returns -1 for a black win, 0 for a draw and 1 for a white win.
+static int wdl_to_value(unsigned wdl, bool white_to_move)
+{
+    int value = wdl == TB_WIN ? 1 : wdl == TB_LOSS ? -1 : 0;
+    return white_to_move ? value : -value;
+}
+
+// probes the root of the position given as bitboards; see probe.
+static int probe_root(int *value, const struct pos *pos)
+{
+    unsigned results[TB_MAX_MOVES];
+    unsigned res = tb_probe_root(pos->white, pos->black, pos->kings,
+                                 pos->queens, pos->rooks, pos->bishops, pos->knights, pos->pawns,
+                                 pos->rule50, pos->castling, pos->ep, pos->turn, results);
+    if (res == TB_RESULT_FAILED)
+    {
+        // std::cout << "fetching failed";
+        return 0;
+    }
+
+    *value = wdl_to_value(TB_GET_WDL(res), pos->turn);
+    return 1;
+}
+
 int probe(int *value, std::string fen)
 {
     struct pos pos0;
@@ -219,24 +256,117 @@ int probe(int *value, std::string fen)
         // std::cout << "too many pieces";
         return 0;
     }
+    return probe_root(value, pos);
+}
 
-    unsigned results[TB_MAX_MOVES];
-    unsigned res = tb_probe_root(pos->white, pos->black, pos->kings,
-                                 pos->queens, pos->rooks, pos->bishops, pos->knights, pos->pawns,
-                                 pos->rule50, pos->castling, pos->ep, pos->turn, results);
-    if (res == TB_RESULT_FAILED)
-    {
-        // std::cout << "fetching failed";
+// returns false if p cannot be in the tablebase: it has more than TB_LARGEST pieces, which is checked first since that
+// is most positions of a game, or it has castling rights.
+static inline bool may_be_in_tablebase(const Position &p)
+{
+    if (pop_count(p.all_pieces<WHITE>() | p.all_pieces<BLACK>()) > (int)TB_LARGEST)
+        return false;
+    const uint64_t entry = p.history[p.ply()].entry;
+    return (entry & WHITE_OO_MASK) && (entry & WHITE_OOO_MASK) && (entry & BLACK_OO_MASK) && (entry & BLACK_OOO_MASK);
+}
+
+// fills pos with the bitboards of p. returns false if p cannot be in the tablebase.
+static bool to_pos(const Position &p, struct pos *pos)
+{
+    if (!may_be_in_tablebase(p))
+        return false;
+    uint64_t white = p.all_pieces<WHITE>(), black = p.all_pieces<BLACK>();
+
+    pos->white = white;
+    pos->black = black;
+    pos->kings = p.bitboard_of(WHITE_KING) | p.bitboard_of(BLACK_KING);
+    pos->queens = p.bitboard_of(WHITE_QUEEN) | p.bitboard_of(BLACK_QUEEN);
+    pos->rooks = p.bitboard_of(WHITE_ROOK) | p.bitboard_of(BLACK_ROOK);
+    pos->bishops = p.bitboard_of(WHITE_BISHOP) | p.bitboard_of(BLACK_BISHOP);
+    pos->knights = p.bitboard_of(WHITE_KNIGHT) | p.bitboard_of(BLACK_KNIGHT);
+    pos->pawns = p.bitboard_of(WHITE_PAWN) | p.bitboard_of(BLACK_PAWN);
+    pos->castling = 0;
+    pos->rule50 = p.num_ply_no_capture_or_pawn_move();
+    pos->turn = p.turn() == WHITE;
+    pos->move = p.ply() / 2 + 1;
+    // like parse_FEN, only keep an en passant square that a pawn of the side to move can capture on.
+    Square epsq = p.history[p.ply()].epsq;
+    pos->ep = 0;
+    if (epsq != NO_SQUARE && (tb_pawn_attacks(epsq, !pos->turn) & pos->pawns & (pos->turn ? white : black)) != 0)
+        pos->ep = epsq;
+    return true;
+}
+
+int probe(int *value, const Position &p)
+{
+    struct pos pos0;
+    if (!to_pos(p, &pos0))
         return 0;
-    }
+    return probe_root(value, &pos0);
+}
 
-    // output: wdl = 0 is black win, wdl = 4 is white win, wdl = 1, 2, 3 is draw
-    unsigned wdl = TB_GET_WDL(res);
-    if (wdl == 0)
-        *value = -1;
-    else if (wdl == 4)
-        *value = 1;
-    else
-        *value = 0;
+int probe_wdl(int *value, const Position &p)
+{
+    struct pos pos0;
+    if (!to_pos(p, &pos0))
+        return 0;
+    // tb_probe_wdl refuses positions whose 50 move counter is not 0, so call the table directly.
+    unsigned wdl = tb_probe_wdl_impl(pos0.white, pos0.black, pos0.kings, pos0.queens, pos0.rooks,
+                                     pos0.bishops, pos0.knights, pos0.pawns, pos0.ep, pos0.turn);
+    if (wdl == TB_RESULT_FAILED)
+        return 0;
+    *value = wdl_to_value(wdl, pos0.turn);
     return 1;
-}
\ No newline at end of file
+}
+
+// a slot holds the key's upper bits, whether it is a wdl probe (bit 4), and the result (bits 0-3):
+// value + 2 for -1, 0, 1, or NOT_FOUND if the probe failed. an empty slot is 0.
+static const uint64_t TAG_MASK = ~(uint64_t)0xffff;
+static const uint64_t WDL_BIT = 1 << 4;
+static const uint64_t NOT_FOUND = 4;
+
+TablebaseCache::TablebaseCache(size_t size_mb) : hits(0), misses(0), probe_nanoseconds(0)
+{
+    size_t n = 1;
+    while (n * 2 * sizeof(uint64_t) <= size_mb * 1024 * 1024)
+        n *= 2;
+    slots.reset(new std::atomic<uint64_t>[n]);
+    mask = n - 1;
+    clear();
+}
+
+void TablebaseCache::clear()
+{
+    for (size_t i = 0; i <= mask; i++)
+        slots[i].store(0, std::memory_order_relaxed);
+}
+
+int TablebaseCache::probe(int *value, const Position &p, bool wdl)
+{
+    if (!may_be_in_tablebase(p))
+        return 0;
+    uint64_t key = p.key();
+    // the root probe also depends on the 50 move counter.
+    if (!wdl)
+        key ^= (uint64_t)(p.num_ply_no_capture_or_pawn_move() + 1) * 0x9E3779B97F4A7C15ull;
+    uint64_t tag = (key & TAG_MASK) | (wdl ? WDL_BIT : 0);
+    std::atomic<uint64_t> &slot = slots[key & mask];
+
+    uint64_t entry = slot.load(std::memory_order_relaxed);
+    if (entry != 0 && (entry & ~(uint64_t)0xf) == tag)
+    {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        uint64_t code = entry & 0xf;
+        if (code == NOT_FOUND)
+            return 0;
+        *value = (int)code - 2;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int found = wdl ? ::probe_wdl(value, p) : ::probe(value, p);
+    auto end = std::chrono::steady_clock::now();
+    misses.fetch_add(1, std::memory_order_relaxed);
+    probe_nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(), std::memory_order_relaxed);
+    slot.store(tag | (found ? (uint64_t)(*value + 2) : NOT_FOUND), std::memory_order_relaxed);
+    return found;
+}
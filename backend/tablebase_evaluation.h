@@ -1,3 +1,4 @@
+#pragma once
 
 #include <assert.h>
 #include <getopt.h>
@@ -7,13 +8,8 @@
 #include "tbprobe.h"
 #include <string>
 #include <iostream>
-
-#define BOARD_RANK_1 0x00000000000000FFull
-#define BOARD_FILE_A 0x8080808080808080ull
-#define square(r, f) (8 * (r) + (f))
-#define rank(s) ((s) >> 3)
-#define file(s) ((s)&0x07)
-#define board(s) ((uint64_t)1 << (s))
+#include <atomic>
+#include <memory>
 
 static const char *wdl_to_str[5] =
     {
@@ -40,10 +36,6 @@ struct pos
     uint16_t move;
 };
 
-/*
- * Parse a FEN string.
- */
-static bool parse_FEN(struct pos *pos, const char *fen);
 inline void init_tablebase(const char *path)
 {
     assert(tb_init(path));
@@ -54,6 +46,72 @@ inline void init_tablebase(const char *path)
 // assigns -1 to value for black win, 0 for draw, 1 for white win
 int probe(int *value, std::string fen);
 
+class Position;
+
+// the same as probe(value, p.fen()), but reads the bitboards of p directly, without building and parsing a fen.
+// returns 0 before touching the tablebase if p has more than TB_LARGEST pieces or any castling rights.
+int probe(int *value, const Position &p);
+
+// probes only the win-draw-loss table, which is much cheaper than probe and meant for positions inside the search.
+// the 50 move counter of p is ignored: the result is the one with a fresh counter.
+int probe_wdl(int *value, const Position &p);
+
+/*
+A fixed size cache of tablebase results keyed by Position::key(), meant to be shared by all the trees of a BatchMCTS,
+since self-play keeps probing the same endgames across games.
+A slot is a single 64 bit word holding the upper bits of the key, the kind of probe and the result, so slots are read
+and written with one atomic operation each and never locked: a racing write simply replaces the slot.
+Positions that cannot be in the tablebase return right away without touching the cache or its counters.
+*/
+class TablebaseCache
+{
+private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    uint64_t mask;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> probe_nanoseconds; // the time spent probing the tablebase on misses
+
+    int probe(int *value, const Position &p, bool wdl);
+
+public:
+    // the number of slots is the largest power of two that fits in size_mb megabytes (at least one).
+    TablebaseCache(size_t size_mb);
+
+    TablebaseCache(const TablebaseCache &other) = delete;
+    TablebaseCache &operator=(const TablebaseCache &other) = delete;
+
+    // the same as probe(value, p); the 50 move counter is part of the key.
+    inline int probe(int *value, const Position &p) { return probe(value, p, false); }
+
+    // the same as probe_wdl(value, p).
+    inline int probe_wdl(int *value, const Position &p) { return probe(value, p, true); }
+
+    void clear();
+
+    // the number of slots
+    inline size_t size() { return mask + 1; }
+
+    inline uint64_t num_hits() { return hits.load(std::memory_order_relaxed); }
+
+    inline uint64_t num_misses() { return misses.load(std::memory_order_relaxed); }
+
+    inline uint64_t total_probe_nanoseconds() { return probe_nanoseconds.load(std::memory_order_relaxed); }
+
+    inline double hit_rate()
+    {
+        uint64_t h = num_hits(), m = num_misses();
+        return h + m > 0 ? h / (double)(h + m) : 0.0;
+    }
+
+    // the average time a miss spent in the tablebase, in microseconds
+    inline double average_probe_microseconds()
+    {
+        uint64_t m = num_misses();
+        return m > 0 ? total_probe_nanoseconds() / (1000.0 * m) : 0.0;
+    }
+};
+
 /*
 int main()
 {
@@ -134,9 +134,9 @@ const Bitboard ROOK_MAGICS[64] = {
 	0x0001000204080011, 0x0001000204000801, 0x0001000082000401, 0x0001FFFAABFAD1A2
 };
 
-//Initializes the magic lookup table for rooks
+//Initializes the lookup table for rooks
 void initialise_rook_attacks() {
-	Bitboard edges, subset, index;
+	Bitboard edges, subset;
 
 	for (Square sq = a1; sq <= h8; ++sq) {
 		edges = ((MASK_RANK[AFILE] | MASK_RANK[HFILE]) & ~MASK_RANK[rank_of(sq)]) |
@@ -147,21 +147,12 @@ void initialise_rook_attacks() {
 
 		subset = 0;
 		do {
-			index = subset;
-			index = index * ROOK_MAGICS[sq];
-			index = index >> ROOK_ATTACK_SHIFTS[sq];
-			ROOK_ATTACKS[sq][index] = get_rook_attacks_for_init(sq, subset);
+			ROOK_ATTACKS[sq][rook_attacks_index(sq, subset)] = get_rook_attacks_for_init(sq, subset);
 			subset = (subset - ROOK_ATTACK_MASKS[sq]) & ROOK_ATTACK_MASKS[sq];
 		} while (subset);
 	}
 }
 
-//Returns the attacks bitboard for a rook at a given square, using the magic lookup table
-Bitboard get_rook_attacks(Square square, Bitboard occ) {
-	return ROOK_ATTACKS[square][((occ & ROOK_ATTACK_MASKS[square]) * ROOK_MAGICS[square])
-		>> ROOK_ATTACK_SHIFTS[square]];
-}
-
 //Returns the 'x-ray attacks' for a rook at a given square. X-ray attacks cover squares that are not immediately
 //accessible by the rook, but become available when the immediate blockers are removed from the board 
 Bitboard get_xray_rook_attacks(Square square, Bitboard occ, Bitboard blockers) {
@@ -200,9 +191,9 @@ const Bitboard BISHOP_MAGICS[64] = {
 	0x0000000010020200, 0x0000000404080200, 0x0000040404040400, 0x0002020202020200
 };
 
-//Initializes the magic lookup table for bishops
+//Initializes the lookup table for bishops
 void initialise_bishop_attacks() {
-	Bitboard edges, subset, index;
+	Bitboard edges, subset;
 
 	for (Square sq = a1; sq <= h8; ++sq) {
 		edges = ((MASK_RANK[AFILE] | MASK_RANK[HFILE]) & ~MASK_RANK[rank_of(sq)]) |
@@ -213,21 +204,12 @@ void initialise_bishop_attacks() {
 
 		subset = 0;
 		do {
-			index = subset;
-			index = index * BISHOP_MAGICS[sq];
-			index = index >> BISHOP_ATTACK_SHIFTS[sq];
-			BISHOP_ATTACKS[sq][index] = get_bishop_attacks_for_init(sq, subset);
+			BISHOP_ATTACKS[sq][bishop_attacks_index(sq, subset)] = get_bishop_attacks_for_init(sq, subset);
 			subset = (subset - BISHOP_ATTACK_MASKS[sq]) & BISHOP_ATTACK_MASKS[sq];
 		} while (subset);
 	}
 }
 
-//Returns the attacks bitboard for a bishop at a given square, using the magic lookup table
-Bitboard get_bishop_attacks(Square square, Bitboard occ) {
-	return BISHOP_ATTACKS[square][((occ & BISHOP_ATTACK_MASKS[square]) * BISHOP_MAGICS[square])
-		>> BISHOP_ATTACK_SHIFTS[square]];
-}
-
 //Returns the 'x-ray attacks' for a bishop at a given square. X-ray attacks cover squares that are not immediately
 //accessible by the rook, but become available when the immediate blockers are removed from the board 
 Bitboard get_xray_bishop_attacks(Square square, Bitboard occ, Bitboard blockers) {
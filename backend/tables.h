@@ -3,6 +3,15 @@
 #include "types.h"
 #include <cstring> 
 
+//With USE_PEXT, the slider attack tables are indexed with the BMI2 pext instruction instead of magic multiplication.
+//It needs -mbmi2, and is only faster on cpus where pext is fast (not AMD before Zen 3), so it is off by default.
+#ifdef USE_PEXT
+#ifndef __BMI2__
+#error "USE_PEXT needs a target with BMI2, e.g. -mbmi2"
+#endif
+#include <immintrin.h>
+#endif
+
 extern const Bitboard KING_ATTACKS[NSQUARES];
 extern const Bitboard KNIGHT_ATTACKS[NSQUARES];
 extern const Bitboard WHITE_PAWN_ATTACKS[NSQUARES];
@@ -18,8 +27,20 @@ extern int ROOK_ATTACK_SHIFTS[NSQUARES];
 extern Bitboard ROOK_ATTACKS[NSQUARES][4096];
 extern void initialise_rook_attacks();
 
+//Returns the index of the rook attacks from a given square, in the given position, into ROOK_ATTACKS[square]
+inline Bitboard rook_attacks_index(Square square, Bitboard occ) {
+#ifdef USE_PEXT
+	return _pext_u64(occ, ROOK_ATTACK_MASKS[square]);
+#else
+	return ((occ & ROOK_ATTACK_MASKS[square]) * ROOK_MAGICS[square]) >> ROOK_ATTACK_SHIFTS[square];
+#endif
+}
+
+//Returns the attacks bitboard for a rook at a given square, using the lookup table
+inline Bitboard get_rook_attacks(Square square, Bitboard occ) {
+	return ROOK_ATTACKS[square][rook_attacks_index(square, occ)];
+}
 
-extern Bitboard get_rook_attacks(Square square, Bitboard occ);
 extern Bitboard get_xray_rook_attacks(Square square, Bitboard occ, Bitboard blockers);
 
 extern Bitboard get_bishop_attacks_for_init(Square square, Bitboard occ);
@@ -29,8 +50,20 @@ extern int BISHOP_ATTACK_SHIFTS[NSQUARES];
 extern Bitboard BISHOP_ATTACKS[NSQUARES][512];
 extern void initialise_bishop_attacks();
 
+//Returns the index of the bishop attacks from a given square, in the given position, into BISHOP_ATTACKS[square]
+inline Bitboard bishop_attacks_index(Square square, Bitboard occ) {
+#ifdef USE_PEXT
+	return _pext_u64(occ, BISHOP_ATTACK_MASKS[square]);
+#else
+	return ((occ & BISHOP_ATTACK_MASKS[square]) * BISHOP_MAGICS[square]) >> BISHOP_ATTACK_SHIFTS[square];
+#endif
+}
+
+//Returns the attacks bitboard for a bishop at a given square, using the lookup table
+inline Bitboard get_bishop_attacks(Square square, Bitboard occ) {
+	return BISHOP_ATTACKS[square][bishop_attacks_index(square, occ)];
+}
 
-extern Bitboard get_bishop_attacks(Square square, Bitboard occ);
 extern Bitboard get_xray_bishop_attacks(Square square, Bitboard occ, Bitboard blockers);
 
 extern Bitboard SQUARES_BETWEEN_BB[NSQUARES][NSQUARES];
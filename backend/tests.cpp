@@ -5,6 +5,12 @@
 #include "PriorityQueue.h"
 #include <unordered_set>
 #include "BatchMCTS.h"
+#include "DataLoader.h"
+#include "ReplayBuffer.h"
+#include "TrainingShard.h"
+#include "tablebase_evaluation.h"
+#include "perft.h"
+#include <random>
 
 template <Color color>
 static bool writeLegalMoves(Position &p, int moves[ROWS][COLS][MOVES_PER_SQUARE], bool fillzeros)
@@ -647,7 +653,8 @@ void memory_test()
 
 void test_memmanager()
 {
-	MemoryBlock memblock(640000, 20);
+	// small enough that the block has to grow while pointers into it are still in use.
+	MemoryBlock memblock(1024, 20);
 	std::vector<std::pair<uint8_t *, uint32_t>> test;
 	std::vector<std::pair<uint8_t *, uint32_t>> reference;
 	for (int i = 0; i < 300; i++)
@@ -696,6 +703,53 @@ void test_memmanager()
 		for (int j = 0; j < reference[i].second; j++)
 			assert(test[i].first[j] == reference[i].first[j]);
 	}
+	assert(memblock.num_chunks() > 1);
+	uint64_t requested = 0, live = 0;
+	for (int i = 0; i < 300; i++)
+		requested += test[i].second;
+	for (int c = 0; c < memblock.get_num_classes(); c++)
+		live += memblock.num_live(c);
+	assert(memblock.requested_bytes() == requested);
+	assert(live == 300);
+	assert(memblock.live_bytes() + memblock.count_free_memory() <= memblock.size());
+	assert(memblock.fragmentation() > 0.0 && memblock.fragmentation() < 1.0);
+	for (int i = 0; i < 300; i++)
+	{
+		memblock.free_(test[i].first, test[i].second);
+		free(reference[i].first);
+	}
+	assert(memblock.requested_bytes() == 0 && memblock.live_bytes() == 0);
+
+	// a tree can live in a growing MemoryBlock without ever being moved.
+	MCTS *m = new MCTS(1000000, std::make_shared<MemoryBlock>(4096, 24), 1.0, false);
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	for (int r = 0; r < ROWS; r++)
+		for (int c = 0; c < COLS; c++)
+			for (int k = 0; k < MOVES_PER_SQUARE; k++)
+				dummy_policy[r][c][k] = 10.0f * std::rand() / RAND_MAX;
+	for (int i = 0; i < 20000; i++)
+	{
+		m->select(1.0f, board, metadata);
+		m->update(2.0f * std::rand() / RAND_MAX - 1.0f, dummy_policy);
+	}
+	// mates and draws found by the search are resolved without the network, adding simulations.
+	assert(m->current_sims() >= 20000);
+	assert(m->size() > 1000);
+	delete m;
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
 }
 
 void test_next_move_randomness()
@@ -893,8 +947,9 @@ void batch_mcts_testcorrectness()
 
 	m.wait_until_no_workers();
 	std::vector<int> counts = m.sim_counts();
+	// every update adds a simulation; mates found by the search add more, since they are resolved without the network.
 	for (int i = 0; i < batch_size; i++)
-		assert(counts[i] == iterations);
+		assert(counts[i] >= iterations && counts[i] < num_sims_per_move);
 }
 
 void batch_mcts_test()
@@ -1227,6 +1282,1645 @@ void not_autoplay_test_batchmcts()
 	}
 }
 
+void multi_leaf_test()
+{
+	const int LEAVES = 8;
+	const float CPUCT = 1.0f;
+	MCTS *m = new MCTS(100000, 1.0, false, "", LEAVES);
+	Position p1;
+
+	Ndarray<int, 3> boards(
+		new int[LEAVES * ROWS * COLS],
+		new long[3]{LEAVES, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+
+	Ndarray<int, 2> metadata(
+		new int[LEAVES * METADATA_LENGTH],
+		new long[2]{LEAVES, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+
+	Ndarray<float, 4> policy(
+		new float[LEAVES * ROWS * COLS * MOVES_PER_SQUARE],
+		new long[4]{LEAVES, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+
+	Ndarray<float, 1> q(
+		new float[LEAVES],
+		new long[1]{LEAVES},
+		new long[1]{1});
+
+	policy.init(0.1f);
+	q.init(0.0f);
+
+	// the root is the only leaf of a fresh tree, so only one leaf can be handed out.
+	assert(m->select(CPUCT, boards, metadata, 0) == 1);
+	m->update(q, policy, 0);
+	assert(m->current_sims() == 1);
+	assert(m->position() == p1);
+
+	int total = 1;
+	for (int i = 0; i < 1000; i++)
+	{
+		int n = m->select(CPUCT, boards, metadata, 0);
+		assert(n >= 1 && n <= LEAVES);
+		assert(m->position() == p1);
+		m->update(q, policy, 0);
+		total += n;
+		assert(m->current_sims() == total);
+	}
+	// virtual loss should spread the leaves out over the root's children.
+	assert(total > 1000 * LEAVES / 2);
+
+	// undo_select must leave no virtual loss behind.
+	m->select(CPUCT, boards, metadata, 0);
+	m->undo_select();
+	assert(m->current_sims() == total);
+	assert(m->position() == p1);
+	delete m;
+
+	// with auto play, a round never goes over the sim limit and the game progresses.
+	const int SIMS = 100;
+	m = new MCTS(SIMS, 1.0, true, "", LEAVES);
+	for (int i = 0; i < 1000; i++)
+	{
+		m->select(CPUCT, boards, metadata, 0);
+		m->update(q, policy, 0);
+		assert(m->current_sims() < SIMS);
+	}
+	assert(m->move_number() > 1 || m->game_number() > 1);
+	delete m;
+
+	boards.destroy();
+	metadata.destroy();
+	policy.destroy();
+	q.destroy();
+}
+
+void batch_mcts_multi_leaf_test()
+{
+	int iterations = 200;
+	int num_sims_per_move = 100000;
+	int num_threads = 4;
+	int batch_size = 256;
+	int num_sectors = 2;
+	int leaves_per_tree = 8;
+
+	Ndarray<int, 3> boards(
+		new int[batch_size * num_sectors * ROWS * COLS],
+		new long[3]{batch_size * num_sectors, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+
+	Ndarray<float, 4> policy(
+		new float[batch_size * ROWS * COLS * MOVES_PER_SQUARE](),
+		new long[4]{batch_size, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+
+	Ndarray<float, 1> q(
+		new float[batch_size],
+		new long[1]{batch_size},
+		new long[1]{1});
+
+	Ndarray<int, 2> metadata(
+		new int[batch_size * num_sectors * METADATA_LENGTH],
+		new long[2]{batch_size * num_sectors, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+
+	q.init(0.0);
+	policy.init(0.1f);
+
+	BatchMCTS m(
+		num_sims_per_move, 1.0, false, "", num_threads, batch_size, num_sectors, 1.0, boards, metadata, leaves_per_tree);
+
+	for (int i = 0; i < iterations * num_sectors; i++)
+	{
+		m.select();
+		m.update(q, policy);
+	}
+
+	m.wait_until_no_workers();
+	std::vector<int> counts = m.sim_counts();
+	assert(counts.size() == (size_t)(batch_size * num_sectors / leaves_per_tree));
+	for (int c : counts)
+	{
+		assert(c > iterations);
+		assert(c <= 1 + (iterations - 1) * leaves_per_tree);
+	}
+
+	boards.destroy();
+	policy.destroy();
+	q.destroy();
+	metadata.destroy();
+}
+
+void transposition_table_test()
+{
+	// the same position reached through different move orders has the same key.
+	Position p1, p2;
+	p1.play<WHITE>(Move(g1, f3, QUIET));
+	p1.play<BLACK>(Move(e7, e6, QUIET));
+	p1.play<WHITE>(Move(b1, c3, QUIET));
+	p2.play<WHITE>(Move(b1, c3, QUIET));
+	p2.play<BLACK>(Move(e7, e6, QUIET));
+	p2.play<WHITE>(Move(g1, f3, QUIET));
+	assert(p1.key() == p2.key());
+	// ...but the side to move and the en passant square are part of the key.
+	Position p3;
+	p3.play<WHITE>(Move(e2, e4, DOUBLE_PUSH));
+	Position p4;
+	p4.play<WHITE>(Move(e2, e3, QUIET));
+	p4.play<BLACK>(Move(g8, f6, QUIET));
+	p4.play<WHITE>(Move(e3, e4, QUIET));
+	p4.play<BLACK>(Move(f6, g8, QUIET));
+	assert(p3.get_hash() == p4.get_hash());
+	assert(p3.key() != p4.key());
+
+	const int ITERATIONS = 20000;
+	float CPUCT = 1.0f;
+	MCTS *m = new MCTS(1000000, 1.0, false);
+	std::shared_ptr<TranspositionTable> tt = std::make_shared<TranspositionTable>(16);
+	m->set_transposition_table(tt);
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	dummy_policy.init(0.1f);
+
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		m->select(CPUCT, board, metadata);
+		m->update(0.0f, dummy_policy);
+	}
+	// every hit is a simulation that never reached the network.
+	assert(tt->num_hits() > 0);
+	assert((uint64_t)m->current_sims() == (uint64_t)ITERATIONS + tt->num_hits());
+	assert(m->position() == Position());
+	std::cout << "transposition table hits: " << tt->num_hits() << " misses: " << tt->num_misses() << "\n";
+	delete m;
+
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
+}
+
+void evaluation_cache_test()
+{
+	// a table of 0 megabytes has a single bucket, so the fifth distinct key evicts with the clock.
+	TranspositionTable small(0, true);
+	assert(small.size() == 4);
+	uint8_t children[3 * TT_MAX_CHILDREN];
+	for (int i = 0; i < 3 * TT_MAX_CHILDREN; i++)
+		children[i] = (uint8_t)i;
+	TTEntry entry;
+	for (uint64_t key = 1; key <= 4; key++)
+		small.store(key, key * 0.1f, children, 1);
+	assert(small.probe(1, entry) && entry.q == 0.1f && entry.num_children == 1);
+	small.store(5, 0.5f, children, 1);
+	assert(small.num_evictions() == 1);
+	assert(small.probe(1, entry));
+	assert(!small.probe(2, entry));
+	assert(small.probe(5, entry));
+
+	// concurrent readers and writers never see a torn entry.
+	TranspositionTable shared(1, true);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; t++)
+	{
+		threads.push_back(std::thread([&shared, t]()
+									  {
+			uint8_t buf[3 * TT_MAX_CHILDREN];
+			TTEntry e;
+			for (int i = 0; i < 100000; i++)
+			{
+				uint64_t key = (uint64_t)((i * 7919 + t) % 20000) * 0x9E3779B97F4A7C15ULL;
+				if (shared.probe(key, e))
+				{
+					assert(e.key == key);
+					assert(e.q == (float)(key & 0xffff));
+					for (int j = 0; j < 3 * e.num_children; j++)
+						assert(e.children[j] == (uint8_t)(key + j));
+				}
+				else
+				{
+					int n = 1 + key % TT_MAX_CHILDREN;
+					for (int j = 0; j < 3 * n; j++)
+						buf[j] = (uint8_t)(key + j);
+					shared.store(key, (float)(key & 0xffff), buf, n);
+				}
+			} }));
+	}
+	for (std::thread &t : threads)
+		t.join();
+	assert(shared.num_hits() + shared.num_misses() == 400000);
+	assert(shared.num_stores() == shared.num_misses());
+
+	// the trees of a batch search the same positions in lockstep, so after every tree plays its best move
+	// and throws its old tree away, the new trees are mostly resolved by the shared cache.
+	int iterations = 200;
+	int batch_size = 16;
+	int num_sectors = 2;
+	Ndarray<int, 3> boards(
+		new int[batch_size * num_sectors * ROWS * COLS],
+		new long[3]{batch_size * num_sectors, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<float, 4> policy(
+		new float[batch_size * ROWS * COLS * MOVES_PER_SQUARE](),
+		new long[4]{batch_size, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<float, 1> q(
+		new float[batch_size],
+		new long[1]{batch_size},
+		new long[1]{1});
+	Ndarray<int, 2> metadata(
+		new int[batch_size * num_sectors * METADATA_LENGTH],
+		new long[2]{batch_size * num_sectors, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	q.init(0.0);
+	policy.init(0.1f);
+
+	BatchMCTS m(1000000, 1.0, false, "", 4, batch_size, num_sectors, 1.0, boards, metadata);
+	m.set_evaluation_cache(16);
+	for (int i = 0; i < iterations * num_sectors; i++)
+	{
+		m.select();
+		m.update(q, policy);
+	}
+	std::shared_ptr<TranspositionTable> cache = m.get_evaluation_cache();
+	m.wait_until_no_workers();
+	uint64_t misses_before = cache->num_misses();
+	assert(cache->num_stores() == misses_before);
+	m.play_best_moves(true);
+	for (int i = 0; i < iterations * num_sectors; i++)
+	{
+		m.select();
+		m.update(q, policy);
+	}
+	m.wait_until_no_workers();
+	assert(cache->num_hits() > 0);
+	for (int c : m.sim_counts())
+		assert(c > iterations);
+	std::cout << "evaluation cache hit rate: " << cache->hit_rate() << "\n";
+
+	// per tree tables split their size between the trees, and refuse to get less than a megabyte each.
+	bool rejected = false;
+	try
+	{
+		m.set_transposition_tables(batch_size * num_sectors - 1);
+	}
+	catch (std::runtime_error &)
+	{
+		rejected = true;
+	}
+	assert(rejected && m.get_evaluation_cache() == cache);
+	m.set_transposition_tables(batch_size * num_sectors);
+	assert(m.get_evaluation_cache() == nullptr);
+
+	boards.destroy();
+	policy.destroy();
+	q.destroy();
+	metadata.destroy();
+}
+
+void thread_pool_test()
+{
+	ThreadPool pool(4);
+	assert(pool.size() == 4);
+	std::vector<int> counts(4, 0);
+	for (int i = 0; i < 1000; i++)
+		pool.run([&](int id)
+				 { counts[id]++; });
+	for (int c : counts)
+		assert(c == 1000);
+
+	// pinning is best effort and must not change the results.
+	ThreadPool pinned(2, true);
+	std::atomic<int> total(0);
+	pinned.run([&](int id)
+			   { total += id + 1; });
+	assert(total == 3);
+
+	// parallel_for covers every index exactly once, whatever gets stolen.
+	std::vector<std::atomic<int>> covered(1000);
+	for (std::atomic<int> &c : covered)
+		c = 0;
+	pool.parallel_for(10, 1000, 7, [&](int start, int end)
+					  {
+		assert(end - start <= 7);
+		for (int i = start; i < end; i++)
+			covered[i]++; });
+	for (int i = 0; i < 1000; i++)
+		assert(covered[i] == (i >= 10 ? 1 : 0));
+}
+
+void scheduling_benchmark()
+{
+	// games that finish a move (play_best_move, tree deletion, tablebase probes, new games) make some trees
+	// much slower to update than others, which a static split of the sector cannot absorb.
+	int num_sims_per_move = 32;
+	int num_threads = 8;
+	int iterations = 256;
+	int batch_sizes[] = {256, 1024, 4096, 16384};
+
+	// every game sees the same random policy; a zero batch stride avoids allocating it batch_size times.
+	float *policy_data = new float[ROWS * COLS * MOVES_PER_SQUARE];
+	for (int i = 0; i < ROWS * COLS * MOVES_PER_SQUARE; i++)
+		policy_data[i] = 10.0f * std::rand() / RAND_MAX;
+
+	using namespace std::chrono;
+	for (int batch_size : batch_sizes)
+	{
+		Ndarray<int, 3> boards(
+			new int[batch_size * ROWS * COLS],
+			new long[3]{batch_size, ROWS, COLS},
+			new long[3]{ROWS * COLS, COLS, 1});
+		Ndarray<int, 2> metadata(
+			new int[batch_size * METADATA_LENGTH],
+			new long[2]{batch_size, METADATA_LENGTH},
+			new long[2]{METADATA_LENGTH, 1});
+		Ndarray<float, 1> q(
+			new float[batch_size],
+			new long[1]{batch_size},
+			new long[1]{1});
+		Ndarray<float, 4> policy(
+			policy_data,
+			new long[4]{batch_size, ROWS, COLS, MOVES_PER_SQUARE},
+			new long[4]{0, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+		for (int i = 0; i < batch_size; i++)
+			q[i] = 2.0f * std::rand() / RAND_MAX - 1.0f;
+
+		for (int chunk_size : {0, BatchMCTS::suggested_steal_chunk_size})
+		{
+			BatchMCTS m(num_sims_per_move, 1.0, true, "", num_threads, batch_size, 1, 1.0, boards, metadata);
+			m.set_work_stealing(chunk_size);
+			auto start = high_resolution_clock::now();
+			for (int i = 0; i < iterations; i++)
+			{
+				m.select();
+				m.update(q, policy);
+			}
+			m.wait_until_no_workers();
+			auto duration = duration_cast<microseconds>(high_resolution_clock::now() - start);
+			std::cout << "batch size " << batch_size << (chunk_size ? ", work stealing: " : ", static split: ")
+					  << duration.count() / 1000.0 / iterations << " ms per update\n";
+		}
+		boards.destroy();
+		metadata.destroy();
+		q.destroy();
+	}
+	delete[] policy_data;
+}
+
+void memory_limit_test()
+{
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	for (int r = 0; r < ROWS; r++)
+		for (int c = 0; c < COLS; c++)
+			for (int k = 0; k < MOVES_PER_SQUARE; k++)
+				dummy_policy[r][c][k] = 10.0f * std::rand() / RAND_MAX;
+
+	// a capped tree keeps searching without growing past its limit.
+	const uint64_t limit = 1 << 16;
+	std::shared_ptr<MemoryManager> managers[] = {std::make_shared<DefaultMemoryManager>(),
+												 std::make_shared<MemoryBlock>(4096, 24)};
+	for (std::shared_ptr<MemoryManager> &mm : managers)
+	{
+		MCTS *m = new MCTS(1000000, mm, 1.0, false);
+		m->set_memory_limit(limit);
+		for (int i = 0; i < 20000; i++)
+		{
+			m->select(1.0f, board, metadata);
+			m->update(2.0f * std::rand() / RAND_MAX - 1.0f, dummy_policy);
+			assert(m->memory_usage() <= limit);
+		}
+		assert(m->current_sims() == 20000);
+		size_t size = m->size();
+		for (int i = 0; i < 1000; i++)
+		{
+			m->select(1.0f, board, metadata);
+			m->update(0.0f, dummy_policy);
+		}
+		assert(m->size() == size);
+		delete m;
+		assert(mm->size() <= limit);
+	}
+
+	// sizes are 64 bit.
+	DefaultMemoryManager d;
+	d.set_limit(5ULL << 30);
+	assert(d.limit() > UINT32_MAX);
+
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
+}
+
+// replays the allocations of a tree being expanded: children arrays of 3 bytes per move,
+// grown by one MCTSNode at a time, and most of the tree freed when a move is played.
+// returns nanoseconds per operation. nodes holds the live allocations afterwards.
+double memory_churn(MemoryManager &mm, int rounds, std::vector<std::pair<uint8_t *, size_t>> &nodes)
+{
+	using namespace std::chrono;
+	std::srand(1);
+	uint64_t ops = 0;
+	auto start = high_resolution_clock::now();
+	for (int r = 0; r < rounds; r++)
+	{
+		for (int i = 0; i < 20000; i++)
+		{
+			if (nodes.empty() || std::rand() % 4 == 0)
+			{
+				size_t size = 3 * (20 + std::rand() % 20);
+				nodes.emplace_back(mm.malloc_(size), size);
+			}
+			else
+			{
+				std::pair<uint8_t *, size_t> &n = nodes[std::rand() % nodes.size()];
+				n.first = mm.realloc_(n.first, n.second, n.second + sizeof(MCTSNode));
+				n.second += sizeof(MCTSNode);
+			}
+			ops++;
+		}
+		while (nodes.size() > 2000)
+		{
+			size_t i = std::rand() % nodes.size();
+			mm.free_(nodes[i].first, nodes[i].second);
+			nodes[i] = nodes.back();
+			nodes.pop_back();
+			ops++;
+		}
+	}
+	return duration_cast<nanoseconds>(high_resolution_clock::now() - start).count() / (double)ops;
+}
+
+void memory_churn_benchmark()
+{
+	int rounds = 500;
+	MemoryBlock block(1 << 20, 24);
+	DefaultMemoryManager malloc_manager;
+	std::vector<std::pair<uint8_t *, size_t>> block_nodes, malloc_nodes;
+	std::cout << "MemoryBlock: " << memory_churn(block, rounds, block_nodes) << " ns per op\n";
+	std::cout << "malloc: " << memory_churn(malloc_manager, rounds, malloc_nodes) << " ns per op\n";
+
+	std::cout << "MemoryBlock size: " << block.size() << " bytes, live: " << block.live_bytes()
+			  << " bytes, requested: " << block.requested_bytes() << " bytes, fragmentation: " << block.fragmentation() << "\n";
+	for (int c = 0; c < block.get_num_classes(); c++)
+		if (block.num_live(c) + block.num_free(c) > 0)
+			std::cout << "class " << block.class_size(c) << ": " << block.num_live(c) << " live, " << block.num_free(c) << " free\n";
+	for (auto &n : malloc_nodes)
+		malloc_manager.free_(n.first, n.second);
+}
+
+// resident set size in bytes, or 0 where /proc is not available.
+uint64_t resident_set_size()
+{
+	std::ifstream statm("/proc/self/statm");
+	uint64_t pages = 0, resident = 0;
+	if (!(statm >> pages >> resident))
+		return 0;
+	return resident * 4096;
+}
+
+void thread_arena_test()
+{
+	int batch_size = 64;
+	Ndarray<int, 3> boards(
+		new int[batch_size * ROWS * COLS],
+		new long[3]{batch_size, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<int, 2> metadata(
+		new int[batch_size * METADATA_LENGTH],
+		new long[2]{batch_size, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	Ndarray<float, 1> q(
+		new float[batch_size],
+		new long[1]{batch_size},
+		new long[1]{1});
+	Ndarray<float, 4> policy(
+		new float[batch_size * ROWS * COLS * MOVES_PER_SQUARE](),
+		new long[4]{batch_size, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	q.init(0.0f);
+	policy.init(0.1f);
+
+	BatchMCTS m(1000000, 1.0, false, "", 4, batch_size, 1, 1.0, boards, metadata, 1, false, true);
+	for (int i = 0; i < 200; i++)
+	{
+		m.select();
+		m.update(q, policy);
+	}
+	m.wait_until_no_workers();
+	uint64_t reserved = m.arena_reserved_bytes();
+	assert(reserved > 0);
+	assert(m.memory_usage() <= reserved);
+	// resetting the trees gives their chunks back to the arenas, which hand them out again.
+	m.play_best_moves(true);
+	for (int i = 0; i < 200; i++)
+	{
+		m.select();
+		m.update(q, policy);
+	}
+	m.wait_until_no_workers();
+	assert(m.arena_reserved_bytes() == reserved);
+	for (int c : m.sim_counts())
+		assert(c >= 200);
+
+	boards.destroy();
+	metadata.destroy();
+	q.destroy();
+	policy.destroy();
+}
+
+void thread_arena_benchmark()
+{
+	// self play with few sims per move, so trees are reset and regrown all the time.
+	int batch_size = 4096;
+	int iterations = 600;
+	float *policy_data = new float[ROWS * COLS * MOVES_PER_SQUARE];
+	for (int i = 0; i < ROWS * COLS * MOVES_PER_SQUARE; i++)
+		policy_data[i] = 10.0f * std::rand() / RAND_MAX;
+	Ndarray<int, 3> boards(
+		new int[batch_size * ROWS * COLS],
+		new long[3]{batch_size, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<int, 2> metadata(
+		new int[batch_size * METADATA_LENGTH],
+		new long[2]{batch_size, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	Ndarray<float, 1> q(
+		new float[batch_size],
+		new long[1]{batch_size},
+		new long[1]{1});
+	Ndarray<float, 4> policy(
+		policy_data,
+		new long[4]{batch_size, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{0, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	for (int i = 0; i < batch_size; i++)
+		q[i] = 2.0f * std::rand() / RAND_MAX - 1.0f;
+
+	using namespace std::chrono;
+	for (bool thread_arenas : {false, true})
+	{
+		uint64_t rss_before = resident_set_size();
+		BatchMCTS m(100, 1.0, true, "", 8, batch_size, 1, 1.0, boards, metadata, 1, false, thread_arenas);
+		auto start = high_resolution_clock::now();
+		for (int i = 0; i < iterations; i++)
+		{
+			m.select();
+			m.update(q, policy);
+		}
+		m.wait_until_no_workers();
+		double seconds = duration_cast<microseconds>(high_resolution_clock::now() - start).count() / 1e6;
+		std::cout << (thread_arenas ? "thread arenas: " : "malloc: ") << iterations * batch_size / seconds << " sims per second, "
+				  << "rss grew by " << (resident_set_size() - rss_before) / (1 << 20) << " MB, trees use "
+				  << m.memory_usage() / (1 << 20) << " MB\n";
+	}
+	boards.destroy();
+	metadata.destroy();
+	q.destroy();
+	delete[] policy_data;
+}
+
+// plays a game with few sims and a uniform policy, writing it to output + "_1" and adding it to buffer, if given.
+// returns the number of moves of the game.
+static int play_recorded_game(string output, RecordFormat format, std::shared_ptr<ReplayBuffer> buffer = nullptr,
+							  string start_fen = "")
+{
+	MCTS m(4, 1.0, true, output);
+	m.set_record_format(format);
+	m.set_replay_buffer(buffer);
+	if (!start_fen.empty())
+	{
+		Position p;
+		Position::set(start_fen, p);
+		m.set_position(p);
+	}
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	dummy_policy.init(0.1f);
+
+	int num_moves = 0;
+	while (m.game_number() == 1)
+	{
+		num_moves = m.move_number();
+		m.select(1.0, board, metadata);
+		m.update(0.0f, dummy_policy);
+	}
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
+	return num_moves;
+}
+
+void game_record_test()
+{
+	string output = "/tmp/game_record_test";
+	int num_moves = play_recorded_game(output, BINARY_RECORDS);
+
+	ifstream in(output + "_1", ios::in | ios::binary);
+	vector<game_record::MoveRecord> moves;
+	int result = 2;
+	assert(game_record::read_game(in, moves, result));
+	assert(result >= -1 && result <= 1);
+	assert((int)moves.size() == num_moves);
+
+	Position p;
+	int start_board[ROWS][COLS];
+	int start_metadata[METADATA_LENGTH];
+	writePosition<WHITE>(p, start_board, start_metadata);
+	assert(memcmp(start_board, moves[0].board, sizeof(start_board)) == 0);
+	assert(memcmp(start_metadata, moves[0].metadata, sizeof(start_metadata)) == 0);
+
+	for (int i = 0; i < (int)moves.size(); i++)
+	{
+		assert(moves[i].color == (i % 2 == 0 ? WHITE : BLACK));
+		assert(!moves[i].policy.empty());
+		float tot = 0;
+		for (auto &entry : moves[i].policy)
+		{
+			assert(entry.first < ROWS * COLS * MOVES_PER_SQUARE);
+			tot += entry.second;
+		}
+		assert(abs(tot - 1.0f) < 0.001f * moves[i].policy.size());
+	}
+	cout << "moves: " << moves.size() << ", result: " << result << "\n";
+
+	// the same game stored as moves only must replay to the same positions.
+	stringstream compact;
+	game_record::write_header(compact);
+	for (auto &rec : moves)
+		game_record::write_compact_move(compact, rec.policy, rec.move);
+	game_record::write_result(compact, result);
+	vector<game_record::MoveRecord> replayed;
+	int replayed_result = 2;
+	assert(game_record::read_game(compact, replayed, replayed_result));
+	assert(replayed_result == result);
+	assert(replayed.size() == moves.size());
+	for (int i = 0; i < (int)moves.size(); i++)
+	{
+		assert(memcmp(replayed[i].board, moves[i].board, sizeof(moves[i].board)) == 0);
+		assert(memcmp(replayed[i].metadata, moves[i].metadata, sizeof(moves[i].metadata)) == 0);
+		assert(replayed[i].color == moves[i].color);
+		assert(replayed[i].move.get_representation() == moves[i].move.get_representation());
+		assert(replayed[i].policy == moves[i].policy);
+	}
+	vector<uint16_t> move_list;
+	for (auto &rec : moves)
+		move_list.push_back(rec.move.get_representation());
+	int n = (int)moves.size();
+	vector<int> boards(n * ROWS * COLS), metadatas(n * METADATA_LENGTH);
+	vector<uint8_t> legal_moves((size_t)n * ROWS * COLS * MOVES_PER_SQUARE);
+	assert(game_record::replay(move_list.data(), n, boards.data(), metadatas.data(), legal_moves.data()) == n);
+	for (int i = 0; i < n; i++)
+	{
+		assert(memcmp(&boards[i * ROWS * COLS], moves[i].board, sizeof(moves[i].board)) == 0);
+		int num_legal = 0;
+		for (int j = 0; j < ROWS * COLS * MOVES_PER_SQUARE; j++)
+			num_legal += legal_moves[(size_t)i * ROWS * COLS * MOVES_PER_SQUARE + j];
+		assert(num_legal == (int)moves[i].policy.size());
+		for (auto &entry : moves[i].policy)
+			assert(legal_moves[(size_t)i * ROWS * COLS * MOVES_PER_SQUARE + entry.first] == 1);
+	}
+
+	in.clear();
+	in.seekg(0, ios::end);
+	cout << "bytes with positions: " << in.tellg() << ", moves only: " << compact.str().size() << "\n";
+
+	// a game set up from a FEN must replay from that position in both formats.
+	const string fen = "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 b - - 0 1";
+	Position start;
+	Position::set(fen, start);
+	int fen_board[ROWS][COLS];
+	int fen_metadata[METADATA_LENGTH];
+	writePosition<BLACK>(start, fen_board, fen_metadata);
+	for (RecordFormat format : {BINARY_RECORDS, MOVES_ONLY_RECORDS})
+	{
+		num_moves = play_recorded_game(output + "_fen", format, nullptr, fen);
+		ifstream fen_in(output + "_fen_1", ios::in | ios::binary);
+		assert(game_record::read_game(fen_in, moves, result));
+		assert((int)moves.size() == num_moves);
+		assert(memcmp(fen_board, moves[0].board, sizeof(fen_board)) == 0);
+		assert(memcmp(fen_metadata, moves[0].metadata, sizeof(fen_metadata)) == 0);
+		for (int i = 0; i < (int)moves.size(); i++)
+			assert(moves[i].color == (i % 2 == 0 ? BLACK : WHITE));
+		move_list.clear();
+		for (auto &rec : moves)
+			move_list.push_back(rec.move.get_representation());
+		n = (int)moves.size();
+		boards.resize(n * ROWS * COLS);
+		metadatas.resize(n * METADATA_LENGTH);
+		assert(game_record::replay(move_list.data(), n, boards.data(), metadatas.data(), nullptr, fen) == n);
+		for (int i = 0; i < n; i++)
+			assert(memcmp(&boards[i * ROWS * COLS], moves[i].board, sizeof(moves[i].board)) == 0);
+	}
+}
+
+void game_writer_test()
+{
+	// many threads pushing at once: every game must arrive exactly once.
+	{
+		const int THREADS = 8;
+		const int GAMES = 2000;
+		GameWriter w("/tmp/game_writer_test_raw", 3, 1 << 12);
+		vector<thread> threads;
+		for (int t = 0; t < THREADS; t++)
+			threads.emplace_back([&w, t]
+								 {
+				for (int i = 0; i < GAMES; i++)
+				{
+					char game[17];
+					snprintf(game, sizeof(game), "%02d:%012d\n", t, i);
+					w.push(game);
+				} });
+		for (thread &t : threads)
+			t.join();
+		w.flush();
+		vector<int> seen(THREADS * GAMES, 0);
+		for (int k = 0; k < w.num_shards(); k++)
+		{
+			ifstream in(w.file_name(k, 0));
+			string line;
+			while (getline(in, line))
+			{
+				int t = stoi(line.substr(0, 2));
+				int i = stoi(line.substr(3));
+				seen[t * GAMES + i]++;
+			}
+		}
+		for (int c : seen)
+			assert(c == 1);
+	}
+
+	// trees playing on their own threads, handing their games to one writer.
+	const int TREES = 4;
+	auto w = std::make_shared<GameWriter>("/tmp/game_writer_test", 2);
+	vector<thread> threads;
+	for (int t = 0; t < TREES; t++)
+		threads.emplace_back([w]
+							 {
+			MCTS m(2, 1.0, true);
+			m.set_record_format(BINARY_RECORDS);
+			m.set_game_writer(w);
+			Ndarray<float, 3> dummy_policy(
+				new float[ROWS * COLS * MOVES_PER_SQUARE],
+				new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+				new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+			Ndarray<int, 2> board(
+				new int[ROWS * COLS],
+				new long[2]{ROWS, COLS},
+				new long[2]{COLS, 1});
+			Ndarray<int, 1> metadata(
+				new int[METADATA_LENGTH],
+				new long[1]{METADATA_LENGTH},
+				new long[1]{1});
+			dummy_policy.init(0.1f);
+			while (m.game_number() <= 2)
+			{
+				m.select(1.0, board, metadata);
+				m.update(0.0f, dummy_policy);
+			}
+			dummy_policy.destroy();
+			board.destroy();
+			metadata.destroy(); });
+	for (thread &t : threads)
+		t.join();
+	// rotating moves every shard on to a new file, leaving the games in complete ones, even when an earlier
+	// flush already wrote every game.
+	w->flush();
+	w->flush(true);
+	assert(w->games_pushed() == 2 * TREES);
+	for (int k = 0; k < w->num_shards(); k++)
+		assert(ifstream(w->file_name(k, 1)).good());
+
+	int num_games = 0;
+	for (int k = 0; k < w->num_shards(); k++)
+	{
+		ifstream in(w->file_name(k, 0), ios::in | ios::binary);
+		vector<game_record::MoveRecord> moves;
+		int result;
+		while (in.peek() != EOF)
+		{
+			assert(game_record::read_game(in, moves, result));
+			assert(!moves.empty());
+			num_games++;
+		}
+	}
+	assert(num_games == 2 * TREES);
+}
+
+void data_loader_test()
+{
+	int text_moves = play_recorded_game("/tmp/data_loader_test_text", TEXT_RECORDS);
+	int binary_moves = play_recorded_game("/tmp/data_loader_test_binary", BINARY_RECORDS);
+	int compact_moves = play_recorded_game("/tmp/data_loader_test_moves", MOVES_ONLY_RECORDS);
+	int total = text_moves + binary_moves + compact_moves;
+
+	DataLoader loader(4);
+	loader.add_file("/tmp/data_loader_test_text_1");
+	loader.add_file("/tmp/data_loader_test_binary_1");
+	loader.add_file("/tmp/data_loader_test_moves_1");
+	loader.add_file("/tmp/data_loader_test_missing");
+	assert(loader.load() == (size_t)total);
+	assert(loader.bad_files() == 1);
+
+	const int BATCH = 4096;
+	const int POLICY_SIZE = ROWS * COLS * MOVES_PER_SQUARE;
+	vector<int> boards(BATCH * ROWS * COLS), metadata(BATCH * METADATA_LENGTH), legal_moves(BATCH * POLICY_SIZE);
+	vector<float> policy(BATCH * POLICY_SIZE), values(BATCH);
+	int seen = 0, n;
+	while ((n = loader.next_batch(100, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data())) > 0)
+	{
+		for (int b = 0; b < n; b++)
+		{
+			float tot = 0;
+			int num_legal = 0;
+			for (int j = 0; j < POLICY_SIZE; j++)
+			{
+				assert(legal_moves[b * POLICY_SIZE + j] == 0 || legal_moves[b * POLICY_SIZE + j] == 1);
+				assert(legal_moves[b * POLICY_SIZE + j] == 1 || policy[b * POLICY_SIZE + j] == 0);
+				tot += policy[b * POLICY_SIZE + j];
+				num_legal += legal_moves[b * POLICY_SIZE + j];
+			}
+			assert(num_legal > 0);
+			assert(abs(tot - 1.0f) < 0.001f);
+			assert(values[b] == -1 || values[b] == 0 || values[b] == 1);
+			for (int j = 0; j < ROWS * COLS; j++)
+				assert(boards[b * ROWS * COLS + j] >= 0 && boards[b * ROWS * COLS + j] <= 14);
+		}
+		seen += n;
+	}
+	assert(seen == total);
+	assert(loader.next_batch(100, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == 0);
+
+	// a full batch
+	for (int i = 0; i < BATCH / binary_moves + 1; i++)
+		loader.add_file("/tmp/data_loader_test_binary_1");
+	loader.load();
+	auto start = std::chrono::high_resolution_clock::now();
+	assert(loader.next_batch(BATCH, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == BATCH);
+	auto end = std::chrono::high_resolution_clock::now();
+	cout << "filled " << BATCH << " examples in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+}
+
+void replay_buffer_test()
+{
+	const int POLICY_SIZE = ROWS * COLS * MOVES_PER_SQUARE;
+	const int BATCH = 256;
+	vector<int> boards(BATCH * ROWS * COLS), metadata(BATCH * METADATA_LENGTH), legal_moves(BATCH * POLICY_SIZE);
+	vector<float> policy(BATCH * POLICY_SIZE), values(BATCH);
+
+	// trees add their games when they end
+	std::shared_ptr<ReplayBuffer> buffer = std::make_shared<ReplayBuffer>(100000, 4, 1);
+	assert(buffer->sample(BATCH, 0, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == 0);
+	int num_moves = play_recorded_game("/tmp/replay_buffer_test", BINARY_RECORDS, buffer);
+	assert(buffer->size() == (size_t)num_moves);
+	assert(buffer->games_added() == 1);
+
+	std::ifstream in("/tmp/replay_buffer_test_1", std::ios::in | std::ios::binary);
+	vector<game_record::MoveRecord> moves;
+	int result;
+	assert(game_record::read_game(in, moves, result));
+	in.close();
+	remove("/tmp/replay_buffer_test_1");
+	assert((int)moves.size() == num_moves);
+
+	assert(buffer->sample(BATCH, 0, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == BATCH);
+	for (int b = 0; b < BATCH; b++)
+	{
+		float tot = 0;
+		int num_legal = 0;
+		for (int j = 0; j < POLICY_SIZE; j++)
+		{
+			assert(legal_moves[b * POLICY_SIZE + j] == 1 || policy[b * POLICY_SIZE + j] == 0);
+			tot += policy[b * POLICY_SIZE + j];
+			num_legal += legal_moves[b * POLICY_SIZE + j];
+		}
+		assert(num_legal > 0);
+		assert(abs(tot - 1.0f) < 0.01f);
+		assert(values[b] == -1 || values[b] == 0 || values[b] == 1);
+	}
+
+	// the oldest positions are dropped first
+	const int CAPACITY = 3 * num_moves / 2;
+	ReplayBuffer small(CAPACITY, 2, 2);
+	small.add_game(moves, 1);
+	assert(small.size() == (size_t)num_moves);
+	small.add_game(moves, 0);
+	assert(small.size() == (size_t)CAPACITY);
+	assert(small.positions_added() == (uint64_t)(2 * num_moves));
+	int old = 0;
+	for (int i = 0; i < 20; i++)
+	{
+		small.sample(BATCH, 0, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data());
+		for (int b = 0; b < BATCH; b++)
+			old += values[b] != 0;
+	}
+	// a third of the positions are left from the first game
+	assert(abs(old / (20.0 * BATCH) - 1.0 / 3) < 0.05);
+
+	// with a short half life, recent positions are sampled far more often
+	int recent_old = 0;
+	for (int i = 0; i < 20; i++)
+	{
+		small.sample(BATCH, 2, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data());
+		for (int b = 0; b < BATCH; b++)
+			recent_old += values[b] != 0;
+	}
+	assert(recent_old < old / 4);
+
+	// more policy entries than fit also evict positions
+	ReplayBuffer few_entries(num_moves, 1, 3, 1);
+	few_entries.add_game(moves, 1);
+	assert(few_entries.size() < (size_t)num_moves);
+	assert(few_entries.sample(BATCH, 0, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == BATCH);
+}
+
+void training_shard_test()
+{
+	const int POLICY_SIZE = ROWS * COLS * MOVES_PER_SQUARE;
+	const string base = "/tmp/training_shard_test";
+
+	// converting the text games that ship with the repo
+	DataLoader loader(2, false);
+	for (string f : {"game_0_1670876843272170671_1", "game_0_1670876843272170671_2", "game_0_1670876843272170671_5",
+					 "game_1_1670876843272499382_1", "game_1_1670876843272499382_2", "game_1_1670876843272499382_5"})
+		loader.add_file("./games/" + f);
+	size_t n = loader.load();
+	assert(n > 0);
+	assert(training_shard::write(loader, base) == (long long)n);
+
+	{
+		ShardReader reader(base);
+		assert(reader.ok());
+		assert(reader.size() == n);
+		vector<int> boards(2 * ROWS * COLS), metadata(2 * METADATA_LENGTH), legal_moves(2 * POLICY_SIZE);
+		vector<float> policy(2 * POLICY_SIZE), values(2);
+		loader.new_epoch();
+		for (size_t i = 0; i < n; i++)
+		{
+			assert(loader.next_batch(1, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()) == 1);
+			assert(reader.fill(i, 1, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()));
+			for (int j = 0; j < ROWS * COLS; j++)
+				assert(boards[j] == boards[ROWS * COLS + j]);
+			for (int j = 0; j < METADATA_LENGTH; j++)
+				assert(metadata[j] == metadata[METADATA_LENGTH + j]);
+			for (int j = 0; j < POLICY_SIZE; j++)
+			{
+				assert(legal_moves[j] == legal_moves[POLICY_SIZE + j]);
+				assert(abs(policy[j] - policy[POLICY_SIZE + j]) < 0.001f);
+			}
+			assert(values[0] == values[1]);
+			assert(reader.policy(reader.record(i)) - reader.policy(reader.record(0)) == (long)reader.record(i).policy_begin);
+		}
+		assert(!reader.fill(n, 0, boards.data(), metadata.data(), policy.data(), legal_moves.data(), values.data()));
+	}
+
+	// writing games as they are read back from game records
+	int num_moves = play_recorded_game(base, BINARY_RECORDS);
+	std::ifstream in(base + "_1", std::ios::in | std::ios::binary);
+	vector<game_record::MoveRecord> moves;
+	int result;
+	assert(game_record::read_game(in, moves, result));
+	in.close();
+	remove((base + "_1").c_str());
+	{
+		ShardWriter writer(base);
+		writer.add_game(moves, result);
+		assert(writer.close());
+	}
+	{
+		ShardReader reader(base);
+		assert(reader.ok());
+		assert(reader.size() == (uint64_t)num_moves);
+		for (int i = 0; i < num_moves; i++)
+		{
+			const training_shard::Record &r = reader.record(i);
+			for (int s = 0; s < ROWS * COLS; s++)
+				assert(r.piece(s) == moves[i].board[s / COLS][s % COLS]);
+			for (int j = 0; j < METADATA_LENGTH; j++)
+				assert(r.metadata(j) == moves[i].metadata[j]);
+			assert(r.value == (moves[i].color == WHITE ? result : -result));
+			assert(r.num_legal == moves[i].policy.size());
+			for (int k = 0; k < r.num_legal; k++)
+				assert(reader.policy(r)[k].index == moves[i].policy[k].first);
+		}
+	}
+	remove((base + ".index").c_str());
+	remove((base + ".data").c_str());
+	assert(!ShardReader(base).ok());
+}
+
+// plays random moves from a few small endgames and checks that probing the bitboards agrees with probing the fen.
+void tablebase_bitboard_probe_test()
+{
+	std::mt19937 rng(7);
+	vector<string> fens = {
+		"5k2/8/8/8/8/8/3KR3/8 w - - 0 1",
+		"8/8/5k2/6p1/8/3K4/8/8 w - - 0 1",
+		"8/8/5k2/6p1/8/3K4/5P2/8 w - - 12 40",
+		"8/8/8/3pP3/8/8/8/k6K w - d6 0 2",
+		"8/8/8/8/3pP3/8/8/k6K b - e3 0 2",
+		"8/8/8/8/2Pp4/8/8/k6K b - c3 0 2",
+		"4k3/8/8/8/8/8/3q4/R3K3 w Q - 0 1",
+		"r3k3/8/8/8/8/8/8/4K2R w Kq - 0 1",
+		"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		"8/8/4k3/3qr3/8/3QR3/4K3/8 w - - 0 1",
+	};
+	int probed = 0;
+	for (const string &fen : fens)
+	{
+		for (int game = 0; game < 20; game++)
+		{
+			Position p;
+			Position::set(fen, p);
+			for (int ply = 0; ply < 30; ply++)
+			{
+				int from_fen = 2, from_bitboards = 2;
+				int found = probe(&from_fen, p.fen());
+				assert(probe(&from_bitboards, p) == found);
+				assert(from_fen == from_bitboards);
+				probed += found;
+
+				Move moves[MAX_MOVES];
+				int n = p.turn() == WHITE ? (int)(p.generate_legals<WHITE>(moves) - moves) : (int)(p.generate_legals<BLACK>(moves) - moves);
+				if (n == 0)
+					break;
+				Move m = moves[rng() % n];
+				if (p.turn() == WHITE)
+					p.play<WHITE>(m);
+				else
+					p.play<BLACK>(m);
+			}
+		}
+	}
+	assert(probed > 0);
+
+	Position endgame, start;
+	Position::set("8/8/5k2/6p1/8/3K4/8/8 w - - 0 1", endgame);
+	int value;
+	const int N = 20000;
+	for (Position *p : {&endgame, &start})
+	{
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < N; i++)
+			probe(&value, p->fen());
+		auto t1 = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < N; i++)
+			probe(&value, *p);
+		auto t2 = std::chrono::high_resolution_clock::now();
+		cout << (p == &start ? "start position" : "endgame") << ": fen probe "
+			 << std::chrono::duration<double, std::micro>(t1 - t0).count() / N << " us, bitboard probe "
+			 << std::chrono::duration<double, std::micro>(t2 - t1).count() / N << " us\n";
+	}
+}
+
+// positions the tablebase knows are resolved inside select, so the network only ever sees the root.
+void tablebase_search_test()
+{
+	const int SIMS = 200;
+	const int LEAVES = 8;
+	const float CPUCT = 1.0f;
+	int value;
+	Position p;
+
+	// results are from white's point of view, whoever is to move.
+	Position::set("5K2/8/8/8/8/8/3kr3/8 b - - 0 1", p);
+	assert(probe(&value, p) && value == -1);
+	assert(probe_wdl(&value, p) && value == -1);
+	Position::set("5K2/8/8/8/8/8/3kr3/8 w - - 7 20", p);
+	assert(probe(&value, p) && value == -1);
+	assert(probe_wdl(&value, p) && value == -1);
+	Position::set("5k2/8/8/8/8/8/3KR3/8 b - - 0 1", p);
+	assert(probe_wdl(&value, p) && value == 1);
+	Position::set("5k2/8/8/8/8/8/3K4/8 w - - 0 1", p);
+	assert(probe_wdl(&value, p) && value == 0);
+	Position start;
+	assert(!probe_wdl(&value, start));
+
+	Ndarray<int, 3> boards(
+		new int[LEAVES * ROWS * COLS],
+		new long[3]{LEAVES, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<int, 2> metadata(
+		new int[LEAVES * METADATA_LENGTH],
+		new long[2]{LEAVES, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	Ndarray<float, 4> policy(
+		new float[LEAVES * ROWS * COLS * MOVES_PER_SQUARE],
+		new long[4]{LEAVES, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<float, 1> q(
+		new float[LEAVES],
+		new long[1]{LEAVES},
+		new long[1]{1});
+	policy.init(0.1f);
+	q.init(0.0f);
+
+	for (int leaves : {1, LEAVES})
+	{
+		for (string fen : {"5k2/8/8/8/8/8/3KR3/8 w - - 0 1", "5K2/8/8/8/8/8/3kr3/8 b - - 0 1"})
+		{
+			MCTS m(SIMS, 1.0, false, "", leaves);
+			Position::set(fen, p);
+			m.set_position(p);
+			int rounds = 0;
+			while (!m.reached_sim_limit())
+			{
+				m.select(CPUCT, boards, metadata, 0);
+				m.update(q, policy, 0);
+				rounds++;
+				assert(m.position() == p);
+			}
+			// one round expands the root, the next resolves every other simulation but the last.
+			assert(rounds <= 3);
+			assert(m.current_sims() == SIMS);
+			// the side to move wins.
+			assert(m.evaluation() > 0.5f);
+		}
+	}
+
+	// with auto play, a game that reaches the tablebase still ends with the right result.
+	std::shared_ptr<ReplayBuffer> buffer = std::make_shared<ReplayBuffer>(1000);
+	MCTS m(SIMS, 1.0, true);
+	m.set_replay_buffer(buffer);
+	Position::set("8/8/8/8/8/2k5/3r4/K7 b - - 0 1", p);
+	m.set_position(p);
+	while (m.game_number() == 1)
+	{
+		m.select(CPUCT, boards, metadata, 0);
+		m.update(q, policy, 0);
+	}
+	// black moved once and won.
+	assert(buffer->size() == 1);
+	vector<int> sample_boards(ROWS * COLS), sample_metadata(METADATA_LENGTH), sample_legal(ROWS * COLS * MOVES_PER_SQUARE);
+	vector<float> sample_policy(ROWS * COLS * MOVES_PER_SQUARE), sample_value(1);
+	buffer->sample(1, 0, sample_boards.data(), sample_metadata.data(), sample_policy.data(), sample_legal.data(), sample_value.data());
+	assert(sample_value[0] == 1);
+	boards.destroy();
+	metadata.destroy();
+	policy.destroy();
+	q.destroy();
+}
+
+void tablebase_cache_test()
+{
+	std::mt19937 rng(11);
+	vector<Position> positions;
+	for (string fen : {"8/8/5k2/6p1/8/3K4/8/8 w - - 0 1", "5k2/8/8/8/8/8/3KR3/8 w - - 0 1", "8/8/8/3pP3/8/8/8/k6K w - d6 0 2",
+					   "8/8/2k5/5r2/8/3Q4/4K3/8 w - - 0 1"})
+	{
+		for (int game = 0; game < 10; game++)
+		{
+			Position p;
+			Position::set(fen, p);
+			for (int ply = 0; ply < 20; ply++)
+			{
+				positions.push_back(p);
+				Move moves[MAX_MOVES];
+				int n = p.turn() == WHITE ? (int)(p.generate_legals<WHITE>(moves) - moves) : (int)(p.generate_legals<BLACK>(moves) - moves);
+				if (n == 0)
+					break;
+				if (p.turn() == WHITE)
+					p.play<WHITE>(moves[rng() % n]);
+				else
+					p.play<BLACK>(moves[rng() % n]);
+			}
+		}
+	}
+	vector<int> expected(positions.size()), expected_wdl(positions.size());
+	vector<int> found(positions.size()), found_wdl(positions.size());
+	for (size_t i = 0; i < positions.size(); i++)
+	{
+		found[i] = probe(&expected[i], positions[i]);
+		found_wdl[i] = probe_wdl(&expected_wdl[i], positions[i]);
+	}
+
+	TablebaseCache cache(1);
+	Position start;
+	int value;
+	assert(!cache.probe(&value, start) && !cache.probe_wdl(&value, start));
+	assert(cache.num_hits() == 0 && cache.num_misses() == 0);
+
+	// several threads probing the same positions at once always see the results of the tablebase.
+	const int THREADS = 4;
+	vector<std::thread> threads;
+	for (int t = 0; t < THREADS; t++)
+		threads.emplace_back([&]()
+							 {
+			for (int pass = 0; pass < 3; pass++)
+				for (size_t i = 0; i < positions.size(); i++)
+				{
+					int v = 2;
+					assert(cache.probe(&v, positions[i]) == found[i]);
+					assert(!found[i] || v == expected[i]);
+					v = 2;
+					assert(cache.probe_wdl(&v, positions[i]) == found_wdl[i]);
+					assert(!found_wdl[i] || v == expected_wdl[i]);
+				} });
+	for (std::thread &t : threads)
+		t.join();
+	assert(cache.num_hits() + cache.num_misses() == 2 * 3 * THREADS * positions.size());
+	assert(cache.hit_rate() > 0.5);
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < positions.size(); i++)
+		cache.probe_wdl(&value, positions[i]);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	cout << "tablebase probe " << cache.average_probe_microseconds() << " us, cached probe "
+		 << std::chrono::duration<double, std::micro>(t1 - t0).count() / positions.size() << " us, hit rate " << cache.hit_rate() << "\n";
+
+	// trees probe through the cache once it is set.
+	std::shared_ptr<TablebaseCache> shared = std::make_shared<TablebaseCache>(1);
+	const long BATCH = 4;
+	Ndarray<int, 3> batch_boards(
+		new int[BATCH * ROWS * COLS],
+		new long[3]{BATCH, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<int, 2> batch_metadata(
+		new int[BATCH * METADATA_LENGTH],
+		new long[2]{BATCH, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	{
+		BatchMCTS batch(100, 1.0, false, "", 2, BATCH, 1, 1.0, batch_boards, batch_metadata);
+		batch.set_tablebase_cache(1);
+		assert(batch.get_tablebase_cache() != nullptr);
+		batch.set_tablebase_cache(0);
+		assert(batch.get_tablebase_cache() == nullptr);
+	}
+	batch_boards.destroy();
+	batch_metadata.destroy();
+
+	MCTS m(100, 1.0, false);
+	m.set_tablebase_cache(shared);
+	Position p;
+	Position::set("5k2/8/8/8/8/8/3KR3/8 w - - 0 1", p);
+	m.set_position(p);
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	dummy_policy.init(0.1f);
+	while (!m.reached_sim_limit())
+	{
+		m.select(1.0, board, metadata);
+		m.update(0.0f, dummy_policy);
+	}
+	// every child is probed once; later visits use the proven node.
+	assert(shared->num_misses() > 0);
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
+}
+
+void mcts_solver_test()
+{
+	const int SIMS = 200;
+	const int LEAVES = 8;
+	const float CPUCT = 1.0f;
+	// Ra8 mates; the position has too many pieces for the tablebase.
+	const string MATE_IN_ONE = "6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1";
+	Position p;
+
+	Ndarray<int, 3> boards(
+		new int[LEAVES * ROWS * COLS],
+		new long[3]{LEAVES, ROWS, COLS},
+		new long[3]{ROWS * COLS, COLS, 1});
+	Ndarray<int, 2> metadata(
+		new int[LEAVES * METADATA_LENGTH],
+		new long[2]{LEAVES, METADATA_LENGTH},
+		new long[2]{METADATA_LENGTH, 1});
+	Ndarray<float, 4> policy(
+		new float[LEAVES * ROWS * COLS * MOVES_PER_SQUARE],
+		new long[4]{LEAVES, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<float, 1> q(
+		new float[LEAVES],
+		new long[1]{LEAVES},
+		new long[1]{1});
+	policy.init(0.1f);
+	q.init(0.0f);
+
+	for (int leaves : {1, LEAVES})
+	{
+		MCTS m(SIMS, 1.0, false, "", leaves);
+		Position::set(MATE_IN_ONE, p);
+		m.set_position(p);
+		int rounds = 0;
+		while (!m.reached_sim_limit())
+		{
+			m.select(CPUCT, boards, metadata, 0);
+			m.update(q, policy, 0);
+			rounds++;
+			assert(m.position() == p);
+		}
+		assert(m.current_sims() == SIMS);
+		// the root is proven as soon as the mate is found, and the mate is then resolved without the network.
+		assert(rounds < SIMS / 2);
+		assert(m.minimax_evaluation() == 1.0f);
+		Move best = m.get_best_move(1.0f);
+		assert(best.from() == a1 && best.to() == a8);
+	}
+
+	// with auto play, the mate is played as soon as it is proven, and recorded as the only move.
+	std::shared_ptr<ReplayBuffer> buffer = std::make_shared<ReplayBuffer>(1000);
+	MCTS m(SIMS, 1.0, true);
+	m.set_replay_buffer(buffer);
+	Position::set(MATE_IN_ONE, p);
+	m.set_position(p);
+	int rounds = 0;
+	while (m.game_number() == 1)
+	{
+		m.select(CPUCT, boards, metadata, 0);
+		m.update(q, policy, 0);
+		rounds++;
+	}
+	assert(rounds < SIMS);
+	assert(buffer->size() == 1);
+	vector<int> sample_boards(ROWS * COLS), sample_metadata(METADATA_LENGTH), sample_legal(ROWS * COLS * MOVES_PER_SQUARE);
+	vector<float> sample_policy(ROWS * COLS * MOVES_PER_SQUARE), sample_value(1);
+	buffer->sample(1, 0, sample_boards.data(), sample_metadata.data(), sample_policy.data(), sample_legal.data(), sample_value.data());
+	assert(sample_value[0] == 1);
+	assert(*std::max_element(sample_policy.begin(), sample_policy.end()) == 1.0f);
+	cout << "mate played after " << rounds << " of " << SIMS << " simulations" << endl;
+	boards.destroy();
+	metadata.destroy();
+	policy.destroy();
+	q.destroy();
+}
+
+void repetition_test()
+{
+	Move moves[MAX_MOVES];
+	auto play = [](Position &p, const string &m)
+	{
+		if (p.turn() == WHITE)
+			p.play<WHITE>(Move(m));
+		else
+			p.play<BLACK>(Move(m));
+	};
+	auto num_legals = [&moves](Position &p)
+	{
+		return p.turn() == WHITE ? p.generate_legals<WHITE>(moves) - moves : p.generate_legals<BLACK>(moves) - moves;
+	};
+
+	// the start position occurs for the third time after the knights went out and back twice.
+	Position p;
+	for (int round = 0; round < 2; round++)
+	{
+		assert(num_legals(p) == 20);
+		for (string m : {"g1f3", "g8f6", "f3g1", "f6g8"})
+			play(p, m);
+		assert(p.num_ply_no_capture_or_pawn_move() == 4 * (round + 1));
+	}
+	assert(num_legals(p) == 0);
+	p.undo<BLACK>(Move("f6g8"));
+	assert(num_legals(p) > 0);
+	p.play<BLACK>(Move("f6g8"));
+	assert(num_legals(p) == 0);
+
+	// a pawn move resets the counter, and only the positions after it are scanned.
+	Position q;
+	play(q, "e2e4");
+	assert(q.num_ply_no_capture_or_pawn_move() == 0);
+	for (int round = 0; round < 2; round++)
+		for (string m : {"g8f6", "g1f3", "f6g8", "f3g1"})
+			play(q, m);
+	assert(q.num_ply_no_capture_or_pawn_move() == 8);
+	assert(num_legals(q) == 0);
+	// a position set from a fen starts a new game.
+	Position::set(q.fen(), q);
+	assert(q.num_ply_no_capture_or_pawn_move() == 0);
+	assert(num_legals(q) > 0);
+}
+
+void position_benchmark()
+{
+	Position p;
+	auto start = std::chrono::steady_clock::now();
+	unsigned long long nodes = perft::count(p, 5);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	assert(nodes == 4865609);
+	Position::set(KIWIPETE, p);
+	unsigned long long kiwipete = perft::count(p, 3);
+	assert(kiwipete == 97862);
+	std::cout << "perft 5: " << nodes / seconds / 1e6 << " million nodes per second\n";
+
+	// select and update play and undo the moves of a path for every simulation. a peaked policy makes the tree deep.
+	const int SIMS = 20000;
+	Ndarray<float, 3> dummy_policy(
+		new float[ROWS * COLS * MOVES_PER_SQUARE],
+		new long[3]{ROWS, COLS, MOVES_PER_SQUARE},
+		new long[3]{COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<int, 2> board(
+		new int[ROWS * COLS],
+		new long[2]{ROWS, COLS},
+		new long[2]{COLS, 1});
+	Ndarray<int, 1> metadata(
+		new int[METADATA_LENGTH],
+		new long[1]{METADATA_LENGTH},
+		new long[1]{1});
+	std::mt19937 rng(3);
+	for (int r = 0; r < ROWS; r++)
+		for (int c = 0; c < COLS; c++)
+			for (int k = 0; k < MOVES_PER_SQUARE; k++)
+				dummy_policy[r][c][k] = 10.0f * (rng() % 1000) / 1000.0f;
+	for (int stride : {0, 1, 4, 8})
+	{
+		MCTS m(SIMS, 1.0, false);
+		m.set_snapshot_stride(stride);
+		start = std::chrono::steady_clock::now();
+		while (!m.reached_sim_limit())
+		{
+			m.select(1.0, board, metadata);
+			m.update(0.0f, dummy_policy);
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "mcts, snapshot stride " << stride << ": " << seconds * 1e6 / SIMS << " us per simulation\n";
+	}
+	std::cout << "position: " << sizeof(Position) << " bytes, snapshot: " << sizeof(PositionSnapshot) << " bytes\n";
+	dummy_policy.destroy();
+	board.destroy();
+	metadata.destroy();
+}
+
+void perft_test()
+{
+	// the suite is right with the root moves split between threads, and with a table shared by them.
+	ThreadPool pool(4);
+	PerftTable table(16);
+	assert(perft::run_suite(std::cout) == 0);
+	assert(perft::run_suite(std::cout, &pool) == 0);
+	assert(perft::run_suite(std::cout, &pool, &table) == 0);
+
+	// transpositions need three plies, so the table only hits from depth 5 (probing at depth 2 and up).
+	Position p;
+	table.clear();
+	assert(perft::count(p, 5, &pool, &table) == 4865609);
+	assert(table.num_hits() > 0);
+
+	// p is left as it was, and depth 0 counts the position itself.
+	Position::set(KIWIPETE, p);
+	std::string fen = p.fen();
+	assert(perft::count(p, 3, &pool, &table) == 97862);
+	assert(perft::count(p, 1, &pool) == 48);
+	assert(perft::count(p, 0) == 1);
+	assert(p.fen() == fen);
+}
+
+void count_legals_test()
+{
+	// counting and looking for any legal move agree with generating the moves, on the suite and along random games,
+	// which end in checkmates, stalemates and draws.
+	std::mt19937 rng(11);
+	for (const perft::Case &c : perft::SUITE)
+	{
+		for (int game = 0; game < 20; game++)
+		{
+			Position p;
+			Position::set(c.fen, p);
+			while (true)
+			{
+				Move moves[MAX_MOVES];
+				size_t n = p.turn() == WHITE ? p.generate_legals<WHITE>(moves) - moves : p.generate_legals<BLACK>(moves) - moves;
+				assert((p.turn() == WHITE ? p.count_legals<WHITE>() : p.count_legals<BLACK>()) == n);
+				assert((p.turn() == WHITE ? p.has_legal_move<WHITE>() : p.has_legal_move<BLACK>()) == (n > 0));
+				if (n == 0)
+					break;
+				Move m = moves[rng() % n];
+				if (p.turn() == WHITE)
+					p.play<WHITE>(m);
+				else
+					p.play<BLACK>(m);
+			}
+		}
+	}
+	// checkmate and stalemate.
+	Position p;
+	Position::set("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1", p);
+	p.play<WHITE>(Move(a1, a8, QUIET));
+	assert(p.count_legals<BLACK>() == 0 && !p.has_legal_move<BLACK>());
+	Position::set("7k/5Q2/6K1/8/8/8/8/8 b - - 0 1", p);
+	assert(p.count_legals<BLACK>() == 0 && !p.has_legal_move<BLACK>());
+}
+
+void snapshot_test()
+{
+	const int SIMS = 3000;
+	const int LEAVES = 8;
+	auto make_boards = [&]()
+	{
+		return Ndarray<int, 3>(
+			new int[LEAVES * ROWS * COLS],
+			new long[3]{LEAVES, ROWS, COLS},
+			new long[3]{ROWS * COLS, COLS, 1});
+	};
+	auto make_metadata = [&]()
+	{
+		return Ndarray<int, 2>(
+			new int[LEAVES * METADATA_LENGTH],
+			new long[2]{LEAVES, METADATA_LENGTH},
+			new long[2]{METADATA_LENGTH, 1});
+	};
+	Ndarray<int, 3> plain_boards = make_boards(), snap_boards = make_boards();
+	Ndarray<int, 2> plain_metadata = make_metadata(), snap_metadata = make_metadata();
+	Ndarray<float, 4> policy(
+		new float[LEAVES * ROWS * COLS * MOVES_PER_SQUARE],
+		new long[4]{LEAVES, ROWS, COLS, MOVES_PER_SQUARE},
+		new long[4]{ROWS * COLS * MOVES_PER_SQUARE, COLS * MOVES_PER_SQUARE, MOVES_PER_SQUARE, 1});
+	Ndarray<float, 1> q(
+		new float[LEAVES],
+		new long[1]{LEAVES},
+		new long[1]{1});
+	std::mt19937 rng(5);
+	for (int i = 0; i < LEAVES; i++)
+	{
+		q[i] = (rng() % 200) / 100.0f - 1.0f;
+		for (int r = 0; r < ROWS; r++)
+			for (int c = 0; c < COLS; c++)
+				for (int k = 0; k < MOVES_PER_SQUARE; k++)
+					policy[i][r][c][k] = 10.0f * (rng() % 1000) / 1000.0f;
+	}
+
+	// a search that resumes from snapshots selects the same leaves as one that plays every move, with or without
+	// auto play, which moves the root.
+	for (bool auto_play : {false, true})
+		for (int leaves : {1, LEAVES})
+			for (int stride : {1, 3})
+			{
+				MCTS plain(200, 1.0, auto_play, "", leaves), snap(200, 1.0, auto_play, "", leaves);
+				plain.set_snapshot_stride(0);
+				snap.set_snapshot_stride(stride);
+				for (int i = 0; i < SIMS; i++)
+				{
+					int n = plain.select(1.0, plain_boards, plain_metadata, 0);
+					assert(snap.select(1.0, snap_boards, snap_metadata, 0) == n);
+					for (int j = 0; j < n; j++)
+					{
+						for (int r = 0; r < ROWS; r++)
+							for (int c = 0; c < COLS; c++)
+								assert(plain_boards[j][r][c] == snap_boards[j][r][c]);
+						for (int k = 0; k < METADATA_LENGTH; k++)
+							assert(plain_metadata[j][k] == snap_metadata[j][k]);
+					}
+					// changing the stride between select and update, as BatchMCTS may, takes effect on the next path.
+					if (i == SIMS / 3)
+						snap.set_snapshot_stride(0);
+					else if (i == 2 * SIMS / 3)
+						snap.set_snapshot_stride(stride + 1);
+					// the move that auto play samples has to be the same.
+					std::srand(i);
+					plain.update(q, policy, 0);
+					std::srand(i);
+					snap.update(q, policy, 0);
+					assert(plain.position() == snap.position());
+					assert(plain.position().num_ply_no_capture_or_pawn_move() == snap.position().num_ply_no_capture_or_pawn_move());
+				}
+				assert(plain.size() == snap.size());
+				assert(plain.move_number() == snap.move_number() && plain.game_number() == snap.game_number());
+			}
+	plain_boards.destroy();
+	snap_boards.destroy();
+	plain_metadata.destroy();
+	snap_metadata.destroy();
+	policy.destroy();
+	q.destroy();
+}
+
 void run_all_tests()
 {
 	// print_test(&batch_mcts_testcorrectness, "batch mcts corectness");
@@ -1255,5 +2949,29 @@ void run_all_tests()
 		print_test(&policy_completeness_test, "Policy Completeness Test");
 		print_test(&policy_rotation_test, "Policy Rotation Test");
 		print_test(&select_and_update_no_errors, "Select and Update no Errors Test");
+		print_test(&multi_leaf_test, "Multi Leaf Select Test");
+		print_test(&batch_mcts_multi_leaf_test, "batch mcts multi leaf test");
+		print_test(&transposition_table_test, "Transposition Table Test");
+		print_test(&evaluation_cache_test, "Evaluation Cache Test");
+		print_test(&thread_pool_test, "Thread Pool Test");
+		print_test(&scheduling_benchmark, "Scheduling Benchmark");
+		print_test(&memory_limit_test, "Memory Limit Test");
+		print_test(&memory_churn_benchmark, "Memory Churn Benchmark");
+		print_test(&thread_arena_test, "Thread Arena Test");
+		print_test(&thread_arena_benchmark, "Thread Arena Benchmark");
+		print_test(&game_record_test, "Game Record Test");
+		print_test(&game_writer_test, "Game Writer Test");
+		print_test(&data_loader_test, "Data Loader Test");
+		print_test(&replay_buffer_test, "Replay Buffer Test");
+		print_test(&training_shard_test, "Training Shard Test");
+		print_test(&tablebase_bitboard_probe_test, "Tablebase Bitboard Probe Test");
+		print_test(&tablebase_search_test, "Tablebase Search Test");
+		print_test(&tablebase_cache_test, "Tablebase Cache Test");
+		print_test(&mcts_solver_test, "MCTS Solver Test");
+		print_test(&repetition_test, "Repetition Test");
+		print_test(&position_benchmark, "Position Benchmark");
+		print_test(&snapshot_test, "Snapshot Test");
+		print_test(&perft_test, "Perft Test");
+		print_test(&count_legals_test, "Count Legals Test");
 	}
 }
\ No newline at end of file
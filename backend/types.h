@@ -255,6 +255,30 @@ inline Move* make<PROMOTION_CAPTURES>(Square from, Bitboard to, Move* list) {
 	return list;
 }
 
+//Takes the place of a move pointer for Position::generate_legals, like an output iterator, but counts the moves
+//written through it instead of storing them. Generation may stop early once limit moves have been counted
+struct MoveCounter {
+	size_t n;
+	size_t limit;
+
+	explicit MoveCounter(size_t limit = SIZE_MAX) : n(0), limit(limit) {}
+
+	inline MoveCounter &operator*() { return *this; }
+	inline MoveCounter &operator++(int) { n++; return *this; }
+	inline void operator=(Move) {}
+};
+
+//Counts the moves that make would add to a move pointer
+template<MoveFlags F = QUIET>
+inline MoveCounter make(Square, Bitboard to, MoveCounter list) {
+	list.n += (F == PROMOTIONS || F == PROMOTION_CAPTURES ? 4 : 1) * pop_count(to);
+	return list;
+}
+
+//Whether move generation can stop. A move pointer always takes every move
+constexpr bool enough_moves(const Move *) { return false; }
+inline bool enough_moves(const MoveCounter &list) { return list.n >= list.limit; }
+
 extern std::ostream& operator<<(std::ostream& os, const Move& m);
 
 extern std::ostream& operator<<(std::ostream& os, const Color& c);
@@ -82,6 +82,8 @@ batch_mcts = BatchMCTS(
     boards_reshaped,
     metadata_reshaped,
 )
+# the binary records are much smaller than the text ones; the readers in utils.py take both.
+batch_mcts.set_record_format(BINARY_RECORDS)
 
 ######################### Helper functions ###############################
 
@@ -129,8 +131,9 @@ def get_trtfunc(model):
 def inference(loop_num):
     pnl("began inference loop {0}!".format(loop_num))
     i = 0
-    num_files = len(os.listdir(output_directory))
-    while num_files < batch_size * num_sectors * 2:
+    start_games = batch_mcts.num_finished_games()
+    num_games = 0
+    while num_games < batch_size * num_sectors:
         for _ in range(num_sims_per_move):
             batch_mcts.select()
             cur_sector = batch_mcts.current_sector()
@@ -143,15 +146,16 @@ def inference(loop_num):
                 now = datetime.now()
                 current_time = now.strftime("%H:%M:%S")
                 print(
-                    "finished move", i // num_sims_per_move, "current time is:", current_time, "num files:", num_files
+                    "finished move", i // num_sims_per_move, "current time is:", current_time, "num games:", num_games
                 )
-            num_files = len(os.listdir(output_directory))
+            num_games = batch_mcts.num_finished_games() - start_games
             i += 1
+    batch_mcts.flush_games()
     pnl("finished inference loop {0}!".format(loop_num))
+    return num_games
 
 
-def train(loopidx):
-    num_games = len(os.listdir(output_directory)) - batch_size * num_sectors
+def train(loopidx, num_games):
     pnl("Training on {0} games! Guessing {1} batches".format(num_games, num_games * 250 / train_batch_size))
     train_loss = tf.keras.metrics.Mean()
     for i, batch in enumerate(generate_batches_from_directory(output_directory, train_batch_size)):
@@ -180,8 +184,8 @@ def train(loopidx):
 
 index = 0
 while True:
-    inference(index)
-    train(index)
+    num_games = inference(index)
+    train(index, num_games)
     manager.save()
     if index and index % 10 == 0:
         pnl("playing games...")
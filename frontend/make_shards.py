@@ -0,0 +1,30 @@
+# converts the game files of a directory (text or binary) into one training shard, which Shard maps into memory.
+# usage: python make_shards.py <games directory> <shard path> [--all] [--threads n]
+# the shard is written to <shard path>.index and <shard path>.data. without --all, the last file of every
+# writer is skipped since it may still be written to, like the training loop does.
+import argparse
+import os
+from ctypes import c_char_p
+from utils import BatchMCTSExtension, DataLoader, Shard
+
+parser = argparse.ArgumentParser()
+parser.add_argument("games_directory")
+parser.add_argument("shard_path")
+parser.add_argument("--all", action="store_true", help="also convert the last file of every writer")
+parser.add_argument("--threads", type=int, default=8)
+parser.add_argument("--tablebase", default="../backend/tablebase")
+args = parser.parse_args()
+
+BatchMCTSExtension.initialize(c_char_p(bytes(args.tablebase, encoding="utf8")))
+
+loader = DataLoader(args.threads, shuffle=False)
+if args.all:
+    for f in sorted(os.listdir(args.games_directory)):
+        if f.startswith("game"):
+            loader.add_file(os.path.join(args.games_directory, f))
+    loader.load()
+else:
+    loader.load_directory(args.games_directory)
+n = loader.write_shard(args.shard_path)
+print("wrote {0} positions to {1}, skipped {2} unreadable files".format(n, args.shard_path, loader.bad_files()))
+print("the shard opens with {0} positions".format(len(Shard(args.shard_path))))
@@ -1,6 +1,7 @@
 import numpy as np
 from constants import *
 import os
+import struct
 from collections import defaultdict, deque
 from numpyctypes import c_ndarray
 from numpy.ctypeslib import load_library
@@ -20,21 +21,86 @@ BatchMCTSExtension.createBatchMCTS.argtypes = [
     c_float,
     Structure,
     Structure,
+    c_int,
+    c_bool,
+    c_bool,
 ]
 BatchMCTSExtension.select.argtypes = [POINTER(c_char)]
 BatchMCTSExtension.wait_until_no_workers.argtypes = [POINTER(c_char)]
 BatchMCTSExtension.update.argtypes = [POINTER(c_char), Structure, Structure]
 BatchMCTSExtension.set_temperature.argtypes = [POINTER(c_char), c_float]
+BatchMCTSExtension.set_transposition_tables.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.set_work_stealing.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.set_record_format.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.replay_moves.argtypes = [Structure, Structure, Structure, Structure, POINTER(c_char)]
+BatchMCTSExtension.flush_games.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.num_finished_games.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.set_memory_limit.argtypes = [POINTER(c_char), c_ulonglong]
+BatchMCTSExtension.set_snapshot_stride.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.memory_usage.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.set_evaluation_cache.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.evaluation_cache_stats.argtypes = [POINTER(c_char), Structure]
+BatchMCTSExtension.evaluation_cache_hit_rate.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.set_tablebase_cache.argtypes = [POINTER(c_char), c_int]
+BatchMCTSExtension.tablebase_cache_stats.argtypes = [POINTER(c_char), Structure]
 BatchMCTSExtension.play_best_moves.argtypes = [POINTER(c_char), c_bool]
 BatchMCTSExtension.all_games_over.argtypes = [POINTER(c_char)]
 BatchMCTSExtension.proportion_of_games_over.argtypes = [POINTER(c_char)]
 BatchMCTSExtension.results.argtypes = [POINTER(c_char), Structure]
 BatchMCTSExtension.current_sector.argtypes = [POINTER(c_char)]
 
+BatchMCTSExtension.createReplayBuffer.argtypes = [c_ulonglong, c_int, c_ulonglong]
+BatchMCTSExtension.deleteReplayBuffer.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.set_replay_buffer.argtypes = [POINTER(c_char), POINTER(c_char)]
+BatchMCTSExtension.replay_buffer_size.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.replay_buffer_games_added.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.replay_buffer_sample.argtypes = [
+    POINTER(c_char),
+    c_double,
+    Structure,
+    Structure,
+    Structure,
+    Structure,
+    Structure,
+]
+BatchMCTSExtension.createDataLoader.argtypes = [c_int, c_bool, c_ulonglong]
+BatchMCTSExtension.deleteDataLoader.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.data_loader_add_file.argtypes = [POINTER(c_char), POINTER(c_char)]
+BatchMCTSExtension.data_loader_load.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.data_loader_new_epoch.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.data_loader_bad_files.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.data_loader_next_batch.argtypes = [POINTER(c_char), Structure, Structure, Structure, Structure, Structure]
+BatchMCTSExtension.data_loader_write_shard.argtypes = [POINTER(c_char), POINTER(c_char)]
+BatchMCTSExtension.openShard.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.closeShard.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.shard_size.argtypes = [POINTER(c_char)]
+BatchMCTSExtension.shard_fill.argtypes = [POINTER(c_char), Structure, Structure, Structure, Structure, Structure, Structure]
+
 BatchMCTSExtension.createBatchMCTS.restype = POINTER(c_char)
 BatchMCTSExtension.all_games_over.restype = c_bool
 BatchMCTSExtension.proportion_of_games_over.restype = c_double
 BatchMCTSExtension.current_sector.restype = c_int
+BatchMCTSExtension.evaluation_cache_hit_rate.restype = c_double
+BatchMCTSExtension.memory_usage.restype = c_ulonglong
+BatchMCTSExtension.num_finished_games.restype = c_ulonglong
+BatchMCTSExtension.replay_moves.restype = c_int
+BatchMCTSExtension.createReplayBuffer.restype = POINTER(c_char)
+BatchMCTSExtension.replay_buffer_size.restype = c_ulonglong
+BatchMCTSExtension.replay_buffer_games_added.restype = c_ulonglong
+BatchMCTSExtension.replay_buffer_sample.restype = c_int
+BatchMCTSExtension.createDataLoader.restype = POINTER(c_char)
+BatchMCTSExtension.data_loader_load.restype = c_ulonglong
+BatchMCTSExtension.data_loader_bad_files.restype = c_int
+BatchMCTSExtension.data_loader_next_batch.restype = c_int
+BatchMCTSExtension.data_loader_write_shard.restype = c_longlong
+BatchMCTSExtension.openShard.restype = POINTER(c_char)
+BatchMCTSExtension.shard_size.restype = c_ulonglong
+BatchMCTSExtension.shard_fill.restype = c_int
+
+# record formats for BatchMCTS.set_record_format; see backend/MCTS.h
+TEXT_RECORDS = 0
+BINARY_RECORDS = 1
+MOVES_ONLY_RECORDS = 2
 
 
 class BatchMCTS:
@@ -50,6 +116,9 @@ class BatchMCTS:
         cpuct: float,
         boards_: np.ndarray,
         metadata_: np.ndarray,
+        leaves_per_tree: int = 1,
+        pin_threads: bool = False,
+        thread_arenas: bool = False,
     ) -> None:
         self.batch_size = batch_size
         boards = c_ndarray(boards_)
@@ -70,6 +139,9 @@ class BatchMCTS:
             c_float(cpuct),
             boards,
             metadata,
+            leaves_per_tree,
+            pin_threads,
+            thread_arenas,
         )
 
     def cleanup(self) -> None:
@@ -92,6 +164,60 @@ class BatchMCTS:
     def set_temperature(self, temp: float) -> None:
         BatchMCTSExtension.set_temperature(self.ptr, c_float(temp))
 
+    # size_mb is split between the trees, at least 1 MB each; see BatchMCTS::set_transposition_tables.
+    def set_transposition_tables(self, size_mb: int) -> None:
+        BatchMCTSExtension.set_transposition_tables(self.ptr, size_mb)
+
+    # off (0) by default; 8 trees per chunk is a reasonable start. see BatchMCTS::set_work_stealing.
+    def set_work_stealing(self, chunk_size: int) -> None:
+        BatchMCTSExtension.set_work_stealing(self.ptr, chunk_size)
+
+    def set_record_format(self, record_format: int) -> None:
+        BatchMCTSExtension.set_record_format(self.ptr, record_format)
+
+    def flush_games(self) -> None:
+        BatchMCTSExtension.flush_games(self.ptr)
+
+    def num_finished_games(self) -> int:
+        return BatchMCTSExtension.num_finished_games(self.ptr)
+
+    # adds every game finished from now on to buffer, a ReplayBuffer. None stops it.
+    def set_replay_buffer(self, buffer) -> None:
+        self.replay_buffer = buffer  # the buffer must outlive its use here
+        BatchMCTSExtension.set_replay_buffer(self.ptr, buffer.ptr if buffer is not None else None)
+
+    def set_memory_limit(self, bytes_per_tree: int) -> None:
+        BatchMCTSExtension.set_memory_limit(self.ptr, bytes_per_tree)
+
+    # every how many moves a tree saves the position along a selected path; 0 plays and undoes every move.
+    def set_snapshot_stride(self, stride: int) -> None:
+        BatchMCTSExtension.set_snapshot_stride(self.ptr, stride)
+
+    def memory_usage(self) -> int:
+        return BatchMCTSExtension.memory_usage(self.ptr)
+
+    def set_evaluation_cache(self, size_mb: int) -> None:
+        BatchMCTSExtension.set_evaluation_cache(self.ptr, size_mb)
+
+    def evaluation_cache_stats(self) -> dict:
+        stats = np.zeros([4], dtype=np.uint64)
+        BatchMCTSExtension.evaluation_cache_stats(self.ptr, c_ndarray(stats))
+        return dict(zip(["hits", "misses", "stores", "evictions"], stats.tolist()))
+
+    def evaluation_cache_hit_rate(self) -> float:
+        return BatchMCTSExtension.evaluation_cache_hit_rate(self.ptr)
+
+    # makes all trees share a cache of tablebase results of size_mb megabytes. 0 disables it.
+    def set_tablebase_cache(self, size_mb: int) -> None:
+        BatchMCTSExtension.set_tablebase_cache(self.ptr, size_mb)
+
+    # hits, misses and the average microseconds a miss spent probing the tablebase
+    def tablebase_cache_stats(self) -> dict:
+        stats = np.zeros([3], dtype=np.uint64)
+        BatchMCTSExtension.tablebase_cache_stats(self.ptr, c_ndarray(stats))
+        hits, misses, nanoseconds = stats.tolist()
+        return {"hits": hits, "misses": misses, "probe_us": nanoseconds / 1000.0 / max(misses, 1)}
+
     def play_best_moves(self, reset: bool) -> None:
         BatchMCTSExtension.play_best_moves(self.ptr, c_bool(reset))
 
@@ -139,6 +265,101 @@ def generate_examples(lines):
         }
 
 
+# the binary game format written by the backend; see backend/GameRecord.h
+GAME_RECORD_MAGIC = b"CPGR"
+GAME_RECORD_VERSIONS = (1, 2, 3)
+GAME_RECORD_HEADER = struct.Struct("<4sHBBBB")
+GAME_RECORD_MOVE = struct.Struct("<{0}sBBHBB".format(ROWS * COLS // 2))
+GAME_RECORD_COMPACT_MOVE = struct.Struct("<HB")
+
+
+# replays the moves of a game from start_fen ("" for the start position), returning the board, metadata and legal moves
+# before each move
+def replay_moves(moves: np.ndarray, start_fen: str = ""):
+    moves = np.ascontiguousarray(moves, dtype=np.uint16)
+    boards = np.zeros([len(moves), ROWS, COLS], dtype=np.int32)
+    metadata = np.zeros([len(moves), METADATA_LENGTH], dtype=np.int32)
+    legal_moves = np.zeros([len(moves), ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.uint8)
+    replayed = BatchMCTSExtension.replay_moves(
+        c_ndarray(moves),
+        c_ndarray(boards),
+        c_ndarray(metadata),
+        c_ndarray(legal_moves),
+        c_char_p(bytes(start_fen, encoding="utf8")),
+    )
+    assert replayed == len(moves), "illegal move in game record"
+    return boards, metadata, legal_moves
+
+
+# a file may hold several games one after the other
+def generate_examples_binary(data: bytes):
+    offset = 0
+    while offset < len(data):
+        magic, version, rows, cols, moves_per_square, metadata_length = GAME_RECORD_HEADER.unpack_from(data, offset)
+        assert magic == GAME_RECORD_MAGIC and version in GAME_RECORD_VERSIONS
+        assert (rows, cols, moves_per_square, metadata_length) == (ROWS, COLS, NUM_MOVES_PER_SQUARE, METADATA_LENGTH)
+        offset += GAME_RECORD_HEADER.size
+        game = []
+        compact = []  # indices into game of the moves only records, whose positions are filled in by replaying
+        moves = []
+        start_fen = ""
+        if data[offset : offset + 1] == b"F":
+            # the game does not begin at the start position
+            n = data[offset + 1]
+            start_fen = data[offset + 2 : offset + 2 + n].decode("ascii")
+            offset += 2 + n
+        while data[offset : offset + 1] in (b"M", b"m"):
+            if data[offset : offset + 1] == b"M":
+                packed, castling, epsq, move, color, n = GAME_RECORD_MOVE.unpack_from(data, offset + 1)
+                offset += 1 + GAME_RECORD_MOVE.size
+                packed = np.frombuffer(packed, dtype=np.uint8)
+                board = np.stack([packed & 0xF, packed >> 4], axis=1).reshape(ROWS, COLS).astype(np.int64)
+                metadata = np.array([(castling >> i) & 1 for i in range(4)] + [epsq])
+            else:
+                move, n = GAME_RECORD_COMPACT_MOVE.unpack_from(data, offset + 1)
+                offset += 1 + GAME_RECORD_COMPACT_MOVE.size
+                board, metadata, color = None, None, len(moves) % 2
+                compact.append(len(game))
+            moves.append(move)
+            entries = np.frombuffer(data, dtype="<u2", count=2 * n, offset=offset).reshape(n, 2)
+            offset += 4 * n
+            policy = np.zeros([ROWS * COLS * NUM_MOVES_PER_SQUARE])
+            legal_moves = np.zeros([ROWS * COLS * NUM_MOVES_PER_SQUARE])
+            policy[entries[:, 0]] = entries[:, 1] / 65535.0
+            legal_moves[entries[:, 0]] = 1
+            # probabilities are rounded to 16 bits, so they are renormalized.
+            policy /= max(np.sum(policy), 1e-9)
+            game.append([board, metadata, policy, legal_moves, color])
+        assert data[offset : offset + 1] == b"R"
+        value = struct.unpack_from("<b", data, offset + 1)[0]
+        offset += 2
+        if compact:
+            # moves only records keep just the visited moves, so the legal moves come from the replay too.
+            boards, metadata, legal_moves = replay_moves(np.array(moves), start_fen)
+            for i in compact:
+                game[i][0] = boards[i].astype(np.int64)
+                game[i][1] = metadata[i].astype(np.int64)
+                game[i][3] = legal_moves[i].reshape(-1).astype(np.float64)
+        for board, metadata, policy, legal_moves, color in game:
+            yield {
+                "board": board,
+                "metadata": metadata,
+                "policy": policy.reshape(ROWS, COLS, NUM_MOVES_PER_SQUARE),
+                "value": value if color == 0 else value * -1,
+                "legal moves": legal_moves.reshape(ROWS, COLS, NUM_MOVES_PER_SQUARE),
+            }
+
+
+# splits the lines of a text file into games, each ending with its WINNER! line
+def generate_examples_text(lines):
+    start = 0
+    for i, line in enumerate(lines):
+        if line.endswith("WINNER!\n"):
+            for example in generate_examples(lines[start : i + 1]):
+                yield example
+            start = i + 1
+
+
 def get_finished_games(dir):
     def get_prefix_suffix(file_name):
         x = file_name.split("_")
@@ -164,20 +385,158 @@ def delete_finished_games(dir):
 
 def generate_examples_from_directory(dir):
     for f in get_finished_games(dir):
-        lines = open(os.path.join(dir, f)).readlines()
-        for example in generate_examples(lines):
+        with open(os.path.join(dir, f), "rb") as file:
+            data = file.read()
+        if data.startswith(GAME_RECORD_MAGIC):
+            examples = generate_examples_binary(data)
+        else:
+            examples = generate_examples_text(data.decode().splitlines(keepends=True))
+        for example in examples:
             yield example
 
 
-def generate_batches_from_directory(dir, batch_size):
-    res = []
+# the last capacity positions of self-play, kept in the backend. BatchMCTS.set_replay_buffer fills it.
+class ReplayBuffer:
+    def __init__(self, capacity: int, num_threads: int = 4, seed: int = None):
+        if seed is None:
+            seed = int.from_bytes(os.urandom(8), "little")
+        self.ptr = BatchMCTSExtension.createReplayBuffer(capacity, num_threads, seed)
+
+    def __del__(self):
+        BatchMCTSExtension.deleteReplayBuffer(self.ptr)
+
+    def size(self) -> int:
+        return BatchMCTSExtension.replay_buffer_size(self.ptr)
+
+    def games_added(self) -> int:
+        return BatchMCTSExtension.replay_buffer_games_added(self.ptr)
+
+    # samples batch_size positions with replacement. with half_life > 0, a position is half as likely to be picked
+    # as one added half_life positions after it. returns None if the buffer is empty.
+    def sample(self, batch_size: int, half_life: float = 0.0):
+        board = np.empty([batch_size, ROWS, COLS], dtype=np.int32)
+        metadata = np.empty([batch_size, METADATA_LENGTH], dtype=np.int32)
+        policy = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.float32)
+        legal_moves = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.int32)
+        value = np.empty([batch_size], dtype=np.float32)
+        n = BatchMCTSExtension.replay_buffer_sample(
+            self.ptr,
+            c_double(half_life),
+            c_ndarray(board),
+            c_ndarray(metadata),
+            c_ndarray(policy),
+            c_ndarray(legal_moves),
+            c_ndarray(value),
+        )
+        if n == 0:
+            return None
+        return {
+            "board": board,
+            "metadata": metadata,
+            "policy": policy,
+            "value": value,
+            "legal moves": legal_moves,
+        }
+
 
-    def result():
-        board = np.concatenate([x["board"][None, ...] for x in res], axis=0)
-        metadata = np.concatenate([x["metadata"][None, ...] for x in res], axis=0)
-        policy = np.concatenate([x["policy"][None, ...] for x in res], axis=0)
-        legal_moves = np.concatenate([x["legal moves"][None, ...] for x in res], axis=0)
-        value = np.array([x["value"] for x in res])
+# reads game files and makes training batches in the backend, on num_threads threads.
+# everything loaded stays in memory, about 350 bytes per position; see backend/DataLoader.h.
+class DataLoader:
+    def __init__(self, num_threads: int = 4, shuffle: bool = True, seed: int = None):
+        if seed is None:
+            seed = int.from_bytes(os.urandom(8), "little")
+        self.ptr = BatchMCTSExtension.createDataLoader(num_threads, c_bool(shuffle), seed)
+
+    def __del__(self):
+        BatchMCTSExtension.deleteDataLoader(self.ptr)
+
+    # queues a game file for the next load
+    def add_file(self, path) -> None:
+        BatchMCTSExtension.data_loader_add_file(self.ptr, c_char_p(bytes(path, encoding="utf8")))
+
+    # loads the queued files. returns the number of examples loaded so far.
+    def load(self) -> int:
+        return BatchMCTSExtension.data_loader_load(self.ptr)
+
+    # loads every finished game of the directory. returns the number of examples loaded so far.
+    def load_directory(self, dir) -> int:
+        for f in get_finished_games(dir):
+            self.add_file(os.path.join(dir, f))
+        return self.load()
+
+    def bad_files(self) -> int:
+        return BatchMCTSExtension.data_loader_bad_files(self.ptr)
+
+    # writes every loaded example, in the order loaded, to the shard path.index and path.data.
+    # returns the number of examples written.
+    def write_shard(self, path) -> int:
+        n = BatchMCTSExtension.data_loader_write_shard(self.ptr, c_char_p(bytes(path, encoding="utf8")))
+        if n < 0:
+            raise IOError("could not write shard " + path)
+        return n
+
+    # yields the batches of one epoch; the last one may be smaller than batch_size.
+    def batches(self, batch_size: int):
+        BatchMCTSExtension.data_loader_new_epoch(self.ptr)
+        while True:
+            board = np.empty([batch_size, ROWS, COLS], dtype=np.int32)
+            metadata = np.empty([batch_size, METADATA_LENGTH], dtype=np.int32)
+            policy = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.float32)
+            legal_moves = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.int32)
+            value = np.empty([batch_size], dtype=np.float32)
+            n = BatchMCTSExtension.data_loader_next_batch(
+                self.ptr,
+                c_ndarray(board),
+                c_ndarray(metadata),
+                c_ndarray(policy),
+                c_ndarray(legal_moves),
+                c_ndarray(value),
+            )
+            if n == 0:
+                return
+            yield {
+                "board": board[:n],
+                "metadata": metadata[:n],
+                "policy": policy[:n],
+                "value": value[:n],
+                "legal moves": legal_moves[:n],
+            }
+
+
+# a training shard written by DataLoader.write_shard, mapped into memory. see backend/TrainingShard.h
+class Shard:
+    def __init__(self, path):
+        self.ptr = BatchMCTSExtension.openShard(c_char_p(bytes(path, encoding="utf8")))
+        if not self.ptr:
+            raise IOError("could not open shard " + path)
+
+    def __del__(self):
+        if self.ptr:
+            BatchMCTSExtension.closeShard(self.ptr)
+
+    def __len__(self) -> int:
+        return BatchMCTSExtension.shard_size(self.ptr)
+
+    # the positions at the given indices, as a batch like those of DataLoader.batches
+    def batch(self, indices):
+        indices = np.ascontiguousarray(indices, dtype=np.uint64)
+        batch_size = len(indices)
+        board = np.empty([batch_size, ROWS, COLS], dtype=np.int32)
+        metadata = np.empty([batch_size, METADATA_LENGTH], dtype=np.int32)
+        policy = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.float32)
+        legal_moves = np.empty([batch_size, ROWS, COLS, NUM_MOVES_PER_SQUARE], dtype=np.int32)
+        value = np.empty([batch_size], dtype=np.float32)
+        n = BatchMCTSExtension.shard_fill(
+            self.ptr,
+            c_ndarray(indices),
+            c_ndarray(board),
+            c_ndarray(metadata),
+            c_ndarray(policy),
+            c_ndarray(legal_moves),
+            c_ndarray(value),
+        )
+        if n < batch_size:
+            raise IndexError("shard index {0} out of range".format(indices[n]))
         return {
             "board": board,
             "metadata": metadata,
@@ -186,14 +545,17 @@ def generate_batches_from_directory(dir, batch_size):
             "legal moves": legal_moves,
         }
 
-    for example in generate_examples_from_directory(dir):
-        res.append(example)
-        if len(res) == batch_size:
-            yield result()
-            res = []
+    # yields random batches of batch_size positions, forever
+    def random_batches(self, batch_size: int):
+        while True:
+            yield self.batch(np.random.randint(0, len(self), size=batch_size, dtype=np.uint64))
+
 
-    if len(res) > 0:
-        yield result()
+def generate_batches_from_directory(dir, batch_size, num_threads=4, shuffle=True):
+    loader = DataLoader(num_threads, shuffle)
+    loader.load_directory(dir)
+    for batch in loader.batches(batch_size):
+        yield batch
 
 
 # plays 2 * num_games games given both models